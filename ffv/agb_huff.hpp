@@ -1,116 +1,170 @@
 #ifndef FFV_AGB_HUFF_HPP
 #define FFV_AGB_HUFF_HPP
 
+#include <algorithm>
 #include <array>
 #include <bit>
+#include <cstdint>
+#include <span>
+#include <vector>
 
 namespace ffv {
 
-template <unsigned TreeLength>
+template <unsigned TreeLength, unsigned LookupBits = 8>
 class agb_huff {
 public:
 	static constexpr auto tree_length = TreeLength;
+	static constexpr auto lookup_bits = LookupBits;
 
-	constexpr agb_huff( const std::array<std::byte, tree_length>& bytes ) noexcept : m_data { to_node_array( bytes ) } {}
+	static_assert( tree_length <= 256, "Node indices are stored in a byte" );
+	static_assert( lookup_bits && 32 % lookup_bits == 0, "Words are split into whole lookups" );
+
+	// The table is built here at run time; at a few hundred thousand steps it is too big to leave to constant evaluation
+	explicit agb_huff( const std::array<std::byte, tree_length>& bytes ) : m_table( to_table( bytes ) ) {}
 
 	auto decompress4( std::istream& stream, std::size_t length ) const noexcept {
+		return decompress_words( length, [&stream]() {
+			std::array<char, 4> word;
+			stream.read( word.data(), word.size() );
+			return std::bit_cast<std::uint32_t>( word );
+		} );
+	}
+
+	auto decompress4( const std::span<const std::byte>& data ) const noexcept {
+		std::size_t offset = 0;
+		return decompress_words( data.size(), [&data, &offset]() {
+			std::array<std::byte, 4> word;
+			std::copy_n( data.data() + offset, word.size(), std::begin( word ) );
+			offset += word.size();
+			return std::bit_cast<std::uint32_t>( word );
+		} );
+	}
+
+protected:
+	static constexpr std::size_t body_size = ( lookup_bits + 1 ) / 2;
+
+	// Outcome of walking lookup_bits bits down the tree from one node, packed two leaves a byte for either starting half
+	struct entry {
+		std::array<std::array<std::byte, body_size>, 2>	body; // By starting half; bytes from the first new one, only advance of them meaningful
+		std::array<std::uint8_t, 2>						advance; // New bytes, by starting half
+		std::byte										head; // Leaf completing the pending byte when starting on the high half
+		std::uint8_t									count; // Leaves reached
+		std::uint8_t									next; // Node the walk stopped at
+		bool											stop; // A branch pointed past the tree; decoding ends after the leaves
+	};
+
+	using table_type = std::vector<std::array<entry, std::size_t { 1 } << lookup_bits>>; // By node
+
+	// Words come from read_word, so streams and mapped memory share the decoder
+	template <class ReadWord>
+	auto decompress_words( std::size_t length, ReadWord&& read_word ) const noexcept {
+		static constexpr auto lookup_mask = ( std::uint32_t { 1 } << lookup_bits ) - 1;
+
 		length &= ~0x3; // Round down to multiple of 4
 
-		std::uint32_t word32;
-		std::size_t bits = 0;
+		// A word yields at most 32 leaves, so room for that plus a whole body is checked once a word
+		static constexpr std::size_t word_room = 16 + body_size;
 
-		std::vector<std::byte> uncompressed;
+		std::vector<std::byte> uncompressed( length * 2 + word_room ); // Grown when the stream compresses better than 2:1
+		auto* out = uncompressed.data();
 		std::size_t pos = 0;
 
-		bool lo = true;
-		while ( length || bits ) {
-			if ( bits == 0 ) {
-				std::array<char, 4> word;
-				stream.read( word.data(), word.size() );
-				length -= 4;
+		std::size_t hi = 0;
+		for ( ; length; length -= 4 ) {
+			const auto word32 = read_word();
 
-				word32 = std::bit_cast<std::uint32_t>( word );
-				bits = 32;
+			if ( static_cast<std::size_t>( uncompressed.data() + uncompressed.size() - out ) < word_room ) [[unlikely]] {
+				const auto written = static_cast<std::size_t>( out - uncompressed.data() );
+				uncompressed.resize( uncompressed.size() * 2 );
+				out = uncompressed.data() + written;
 			}
 
-			--bits;
-			if ( word32 & ( 1 << bits ) ) {
-				const auto& n = m_data[pos];
-				pos = index_right( n );
-				if ( pos >= m_data.size() ) break;
-
-				if ( n.end_right ) {
-					if ( lo ) {
-						uncompressed.push_back( std::bit_cast<std::byte>( m_data[pos] ) );
-					} else {
-						uncompressed.back() |= std::bit_cast<std::byte>( m_data[pos] ) << 4;
-					}
-					lo = !lo;
-					pos = 0;
+			for ( auto shift = static_cast<int>( 32 - lookup_bits ); shift >= 0; shift -= lookup_bits ) {
+				const auto& e = m_table[pos][( word32 >> shift ) & lookup_mask];
+				if ( hi ) {
+					out[-1] |= e.head;
 				}
-			} else {
-				const auto& n = m_data[pos];
-				pos = index_left( n );
-				if ( pos >= m_data.size() ) break;
-
-				if ( n.end_left ) {
-					if ( lo ) {
-						uncompressed.push_back( std::bit_cast<std::byte>( m_data[pos] ) );
-					} else {
-						uncompressed.back() |= std::bit_cast<std::byte>( m_data[pos] ) << 4;
-					}
-					lo = !lo;
-					pos = 0;
+				std::copy_n( std::cbegin( e.body[hi] ), body_size, out );
+				out += e.advance[hi];
+				hi ^= e.count & 1;
+
+				if ( e.stop ) [[unlikely]] {
+					uncompressed.resize( static_cast<std::size_t>( out - uncompressed.data() ) );
+					return uncompressed;
 				}
+				pos = e.next;
 			}
 		}
 
+		uncompressed.resize( static_cast<std::size_t>( out - uncompressed.data() ) );
 		return uncompressed;
 	}
 
-protected:
-	struct node {
-		std::uint8_t	next : 6;
-		bool			end_left : 1;
-		bool			end_right : 1;
-
-		constexpr bool operator ==( const node& other ) const noexcept {
-			return this == &other;
+	// Children of each node are worked out once here rather than per bit, then every node and bit pattern is walked ahead of time
+	static auto to_table( const std::array<std::byte, tree_length>& bytes ) -> table_type {
+		std::array<std::size_t, tree_length> left {};
+		std::array<std::size_t, tree_length> right {};
+		std::array<bool, tree_length> leafLeft {};
+		std::array<bool, tree_length> leafRight {};
+		for ( std::size_t ii = 0; ii < tree_length; ++ii ) {
+			const auto base = ( ( ii + 1 ) & ~std::size_t { 1 } ) + ( static_cast<std::size_t>( bytes[ii] & std::byte { 0x3f } ) * 2 );
+			left[ii] = base + 1;
+			right[ii] = base + 2;
+			leafLeft[ii] = static_cast<bool>( bytes[ii] & std::byte { 0x80 } );
+			leafRight[ii] = static_cast<bool>( bytes[ii] & std::byte { 0x40 } );
 		}
-	};
 
-	using node_array_type = std::array<node, TreeLength>;
+		table_type table( tree_length );
+		for ( std::size_t start = 0; start < tree_length; ++start ) {
+			for ( std::size_t bits = 0; bits < table[start].size(); ++bits ) {
+				auto& e = table[start][bits];
+
+				std::array<std::byte, lookup_bits> leaves {};
+				auto pos = start;
+				auto bit = lookup_bits;
+				while ( bit-- ) {
+					const auto isRight = ( bits >> bit ) & 1;
+					const auto next = isRight ? right[pos] : left[pos];
+					if ( next >= tree_length ) {
+						e.stop = true;
+						break;
+					}
 
-	static constexpr auto to_node_array( const std::array<std::byte, tree_length>& bytes ) noexcept -> node_array_type {
-		std::array<node, tree_length> na;
-		auto ii = na.size();
-		while ( ii-- ) {
-			na[ii].next = static_cast<std::uint8_t>( bytes[ii] ) & 0x3f;
-			na[ii].end_left = static_cast<bool>( bytes[ii] & std::byte { 0x80 } );
-			na[ii].end_right = static_cast<bool>( bytes[ii] & std::byte { 0x40 } );
+					if ( isRight ? leafRight[pos] : leafLeft[pos] ) {
+						leaves[e.count++] = bytes[next];
+						pos = 0;
+					} else {
+						pos = next;
+					}
+				}
+				e.next = static_cast<std::uint8_t>( pos );
+
+				// Low half first: a leaf either starts a new byte or fills the high half of the last one
+				for ( std::size_t half = 0; half < 2; ++half ) {
+					std::size_t written = 0;
+					for ( std::size_t ii = 0; ii < e.count; ++ii ) {
+						if ( ( ii + half ) % 2 == 0 ) {
+							e.body[half][written++] = leaves[ii];
+						} else if ( written ) {
+							e.body[half][written - 1] |= leaves[ii] << 4;
+						} else {
+							e.head = leaves[ii] << 4;
+						}
+					}
+					e.advance[half] = static_cast<std::uint8_t>( written );
+				}
+			}
 		}
-		return na;
-	}
-
-	constexpr auto index_of( const node& node ) const noexcept {
-		return std::distance( std::cbegin( m_data ), std::find( std::cbegin( m_data ), std::cend( m_data ), node ) );
-	}
-
-	constexpr auto index_left( const node& node ) const noexcept {
-		return ( ( index_of( node ) + 1 ) & ~1u ) + ( static_cast<std::size_t>( node.next ) * 2 ) + 1;
-	}
-
-	constexpr auto index_right( const node& node ) const noexcept {
-		return ( ( index_of( node ) + 1 ) & ~1u ) + ( static_cast<std::size_t>( node.next ) * 2 ) + 2;
+		return table;
 	}
 
-	const node_array_type	m_data;
+	const table_type	m_table; // By node then by the next lookup_bits bits
 
 };
 
 template <typename... Ts>
-static constexpr auto make_huff( Ts&&... args ) noexcept -> agb_huff<sizeof...( Ts )> {
-	return { std::array<std::byte, sizeof...( Ts )> { std::byte( std::forward<Ts>( args ) )... } };
+auto make_huff( Ts&&... args ) -> agb_huff<sizeof...( Ts )> {
+	return agb_huff<sizeof...( Ts )> { std::array<std::byte, sizeof...( Ts )> { std::byte( std::forward<Ts>( args ) )... } };
 }
 
 } // ffv
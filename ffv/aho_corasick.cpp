@@ -0,0 +1,107 @@
+#include "aho_corasick.hpp"
+
+#include <algorithm>
+#include <deque>
+#include <queue>
+
+using namespace ffv;
+
+static constexpr char fold_case( const char c ) noexcept {
+	return ( c >= 'A' && c <= 'Z' ) ? static_cast<char>( c - 'A' + 'a' ) : c;
+}
+
+aho_corasick::size_type aho_corasick::insert( const std::string_view& pattern ) {
+	auto& stored = m_patterns.emplace_back( pattern );
+	if ( m_ignoreCase ) {
+		for ( auto& c : stored ) {
+			c = fold_case( c );
+		}
+	}
+	return static_cast<size_type>( m_patterns.size() - 1 );
+}
+
+void aho_corasick::compile() {
+	static constexpr auto npos = static_cast<size_type>( -1 );
+
+	const auto resource = m_transitions.get_allocator().resource();
+
+	// Only bytes that appear in some pattern need a column of their own
+	m_classes.fill( 0 );
+	m_classCount = 1;
+	m_longest = 0;
+	for ( const auto& pattern : m_patterns ) {
+		m_longest = std::max( m_longest, pattern.size() );
+		for ( const auto c : pattern ) {
+			auto& cls = m_classes[static_cast<unsigned char>( c )];
+			if ( cls == 0 ) {
+				cls = static_cast<std::uint16_t>( m_classCount++ );
+			}
+		}
+	}
+
+	if ( m_ignoreCase ) {
+		for ( auto c = 'A'; c <= 'Z'; ++c ) {
+			m_classes[static_cast<unsigned char>( c )] = m_classes[static_cast<unsigned char>( fold_case( c ) )];
+		}
+	}
+
+	// Trie of the patterns
+	m_transitions.assign( m_classCount, npos );
+	std::pmr::vector<std::pmr::vector<size_type>> outputs( 1, resource );
+	for ( size_type id = 0; id < m_patterns.size(); ++id ) {
+		if ( m_patterns[id].empty() ) {
+			continue;
+		}
+
+		size_type state = 0;
+		for ( const auto c : m_patterns[id] ) {
+			const auto index = state * m_classCount + m_classes[static_cast<unsigned char>( c )];
+			if ( m_transitions[index] == npos ) {
+				m_transitions[index] = static_cast<size_type>( outputs.size() );
+				outputs.emplace_back();
+				m_transitions.resize( outputs.size() * m_classCount, npos );
+			}
+			state = m_transitions[index];
+		}
+		outputs[state].push_back( id );
+	}
+
+	// Breadth first, so every failure state is complete before the states that fall back to it
+	std::pmr::vector<size_type> failure( outputs.size(), 0, resource );
+	std::queue<size_type, std::pmr::deque<size_type>> pending { std::pmr::deque<size_type>( resource ) };
+	for ( std::uint32_t cls = 0; cls < m_classCount; ++cls ) {
+		auto& next = m_transitions[cls];
+		if ( next == npos ) {
+			next = 0;
+		} else {
+			pending.push( next );
+		}
+	}
+
+	while ( !pending.empty() ) {
+		const auto state = pending.front();
+		pending.pop();
+
+		for ( std::uint32_t cls = 0; cls < m_classCount; ++cls ) {
+			const auto fallback = m_transitions[failure[state] * m_classCount + cls];
+			auto& next = m_transitions[state * m_classCount + cls];
+			if ( next == npos ) {
+				next = fallback;
+				continue;
+			}
+
+			failure[next] = fallback;
+			outputs[next].insert( std::end( outputs[next] ), std::cbegin( outputs[fallback] ), std::cend( outputs[fallback] ) );
+			pending.push( next );
+		}
+	}
+
+	m_outputOffsets.clear();
+	m_outputs.clear();
+	m_outputOffsets.reserve( outputs.size() + 1 );
+	for ( const auto& out : outputs ) {
+		m_outputOffsets.push_back( static_cast<size_type>( m_outputs.size() ) );
+		m_outputs.insert( std::end( m_outputs ), std::cbegin( out ), std::cend( out ) );
+	}
+	m_outputOffsets.push_back( static_cast<size_type>( m_outputs.size() ) );
+}
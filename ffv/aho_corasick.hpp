@@ -0,0 +1,87 @@
+#ifndef FFV_AHO_CORASICK_HPP
+#define FFV_AHO_CORASICK_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace ffv {
+
+// Finds every occurrence of a set of patterns in one pass over the text
+class aho_corasick {
+public:
+	using size_type = std::uint32_t;
+
+	static constexpr auto npos = static_cast<std::size_t>( -1 );
+
+	// Patterns, tables and the scratch of compile() all come from resource
+	explicit aho_corasick( const bool ignoreCase = false, std::pmr::memory_resource* resource = std::pmr::get_default_resource() ) noexcept : m_ignoreCase { ignoreCase }, m_patterns( resource ), m_classes {}, m_classCount { 1 }, m_transitions( resource ), m_outputOffsets( resource ), m_outputs( resource ) {}
+
+	// Returns the id of the pattern, ids count up from zero; empty patterns never match
+	size_type	insert( const std::string_view& pattern );
+
+	// Builds the automaton, call after the last insert and before scanning
+	void		compile();
+
+	size_type size() const noexcept {
+		return static_cast<size_type>( m_patterns.size() );
+	}
+
+	// As inserted, lowered when ignoring case
+	std::string_view pattern( const size_type id ) const noexcept {
+		return m_patterns[id];
+	}
+
+	// Calls func( id, end ) for each occurrence, end being one past its last character
+	template <class Func>
+	void scan( const std::string_view& text, Func&& func ) const {
+		size_type state = 0;
+		for ( std::size_t ii = 0; ii < text.size(); ++ii ) {
+			state = m_transitions[state * m_classCount + m_classes[static_cast<unsigned char>( text[ii] )]];
+
+			const auto last = m_outputOffsets[state + 1];
+			for ( auto out = m_outputOffsets[state]; out < last; ++out ) {
+				func( m_outputs[out], ii + 1 );
+			}
+		}
+	}
+
+	// Start of the leftmost occurrence of any pattern at or after pos, npos if there is none
+	std::size_t find( const std::string_view& text, const std::size_t pos ) const noexcept {
+		auto found = npos;
+		size_type state = 0;
+		for ( auto ii = pos; ii < text.size(); ++ii ) {
+			if ( found != npos && ii + 1 >= found + m_longest ) {
+				break; // Anything ending from here on starts after found
+			}
+
+			state = m_transitions[state * m_classCount + m_classes[static_cast<unsigned char>( text[ii] )]];
+
+			const auto last = m_outputOffsets[state + 1];
+			for ( auto out = m_outputOffsets[state]; out < last; ++out ) {
+				found = std::min( found, ii + 1 - m_patterns[m_outputs[out]].size() );
+			}
+		}
+		return found;
+	}
+
+protected:
+	bool						m_ignoreCase;
+	std::pmr::vector<std::pmr::string>	m_patterns; // Lowered when ignoring case
+	std::size_t					m_longest { 0 }; // Characters in the longest pattern
+
+	std::array<std::uint16_t, 256>	m_classes; // Bytes that appear in no pattern share class 0
+	std::uint32_t					m_classCount;
+	std::pmr::vector<size_type>		m_transitions; // Dense, state * m_classCount + class
+	std::pmr::vector<size_type>		m_outputOffsets; // Per state into m_outputs, plus one past the end
+	std::pmr::vector<size_type>		m_outputs; // Pattern ids ending at each state, suffix matches included
+
+};
+
+} // ffv
+
+#endif // define FFV_AHO_CORASICK_HPP
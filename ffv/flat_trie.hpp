@@ -0,0 +1,99 @@
+#ifndef FFV_FLAT_TRIE_HPP
+#define FFV_FLAT_TRIE_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <span>
+
+namespace ffv {
+
+// Read-only trie as flat arrays, the layout tree::freeze packs its children into; the arrays can be constexpr data or owned elsewhere
+template <class Key>
+struct flat_trie {
+	using size_type = std::uint32_t;
+
+	static constexpr auto npos = static_cast<size_type>( -1 );
+
+	std::span<const size_type>	dispatch; // Child of the root for each of the 256 byte values, npos if none
+	std::span<const size_type>	child_offsets; // Per node into child_keys and child_nodes, plus one past the end
+	std::span<const Key>		child_keys;
+	std::span<const size_type>	child_nodes;
+	std::span<const size_type>	entries; // Per node, npos where no value ends; node 0 is the root
+
+	constexpr size_type child_of( const size_type parent, const Key& key ) const noexcept {
+		if ( parent == 0 ) {
+			return dispatch[static_cast<unsigned char>( key )];
+		}
+
+		const auto keys = std::cbegin( child_keys );
+		const auto first = keys + child_offsets[parent];
+		const auto last = keys + child_offsets[parent + 1];
+		const auto it = std::find( first, last, key );
+		return it == last ? npos : child_nodes[static_cast<std::size_t>( std::distance( keys, it ) )];
+	}
+
+	// First node with an entry on the path of [first, last), like tree::find; first is left on the element it ends at
+	template <class Iter>
+	constexpr size_type find( Iter& first, const Iter last ) const noexcept {
+		if ( first == last ) {
+			return npos;
+		}
+
+		auto pos = child_of( 0, *first );
+		while ( pos != npos ) {
+			if ( entries[pos] != npos ) {
+				return pos;
+			}
+
+			if ( ++first == last ) {
+				break;
+			}
+
+			pos = child_of( pos, *first );
+		}
+
+		return npos;
+	}
+
+	// Deepest node with an entry on the path of [first, last), like tree::find_longest
+	template <class Iter>
+	constexpr size_type find_longest( Iter& first, const Iter last ) const noexcept {
+		auto match = npos;
+		auto matchLast = first;
+
+		auto pos = size_type { 0 };
+		for ( auto it = first; it != last; ++it ) {
+			pos = child_of( pos, *it );
+			if ( pos == npos ) {
+				break;
+			}
+
+			if ( entries[pos] != npos ) {
+				match = pos;
+				matchLast = it;
+			}
+		}
+
+		if ( match != npos ) {
+			first = matchLast;
+		}
+
+		return match;
+	}
+
+	// Node spelt by exactly [first, last), npos if there is none
+	template <class Iter>
+	constexpr size_type find_exact( Iter first, const Iter last ) const noexcept {
+		auto pos = size_type { 0 };
+		for ( ; first != last && pos != npos; ++first ) {
+			pos = child_of( pos, *first );
+		}
+
+		return pos;
+	}
+};
+
+} // ffv
+
+#endif // define FFV_FLAT_TRIE_HPP
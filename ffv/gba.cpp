@@ -1,8 +1,16 @@
 #include "gba.hpp"
 
 #include <algorithm>
+#include <bit>
+#include <cstring>
+#include <stdexcept>
 #include <string>
 
+#if defined( __SSE2__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 2 )
+#define FFV_GBA_SSE2
+#include <emmintrin.h>
+#endif
+
 #include "agb_huff.hpp"
 #include "istream_find.hpp"
 #include "tree.hpp"
@@ -31,6 +39,18 @@ namespace detail {
 		return std::bit_cast<Type>( buffer );
 	}
 
+	// Reads from an offset into mapped memory, throwing rather than reading past the end
+	template <typename Type>
+	auto read( const std::span<const std::byte>& data, const std::size_t offset ) {
+		if ( offset > data.size() || data.size() - offset < sizeof( Type ) ) [[unlikely]] {
+			throw std::out_of_range( "Read past the end of the ROM" );
+		}
+
+		std::array<std::byte, sizeof( Type )> buffer;
+		std::copy_n( data.data() + offset, buffer.size(), std::begin( buffer ) );
+		return std::bit_cast<Type>( buffer );
+	}
+
 	std::uint8_t read_complement( std::istream& stream ) noexcept {
 		std::array<char, 28> buffer;
 		stream.read( buffer.data(), buffer.size() );
@@ -41,6 +61,33 @@ namespace detail {
 		return -( complement + 0x19 );
 	}
 
+	std::uint8_t read_complement( const std::span<const std::byte, 28>& bytes ) noexcept {
+		std::uint8_t complement = 0;
+		for ( const auto& byte : bytes ) {
+			complement += static_cast<std::uint8_t>( byte );
+		}
+		return -( complement + 0x19 );
+	}
+
+	std::size_t find( const std::span<const std::byte>& rom, const std::span<const std::byte>& bytes ) noexcept {
+		const auto it = std::search( std::cbegin( rom ), std::cend( rom ), std::cbegin( bytes ), std::cend( bytes ) );
+		return it == std::cend( rom ) ? gba::npos : static_cast<std::size_t>( std::distance( std::cbegin( rom ), it ) );
+	}
+
+	// Where the cartridge header fields sit in the ROM image
+	struct header_offsets {
+		static constexpr std::size_t logo = 0x04;
+		static constexpr std::size_t logo_size = 156;
+		static constexpr std::size_t title = 0xa0;
+		static constexpr std::size_t serial = 0xac;
+		static constexpr std::size_t maker = 0xb0;
+		static constexpr std::size_t fixed = 0xb2;
+		static constexpr std::size_t device = 0xb3;
+		static constexpr std::size_t version = 0xbc;
+		static constexpr std::size_t complement = 0xbd;
+		static constexpr std::size_t end = 0xbe;
+	};
+
 	static constexpr auto font_header = detail::make_byte_array(
 		0x00, 0x00, 0x00, 0x00, 'F', 'O', 'N', 'T'
 	);
@@ -49,16 +96,75 @@ namespace detail {
 		0x00, 0x00, 0x00, 0x00, 'T', 'E', 'X', 'T'
 	);
 
+	static constexpr auto text_offsets_start = sizeof( text_header ) + sizeof( gba::text_data::header );
+
+	// Table headers are a zero word then the tag; zero bytes are everywhere in a ROM, so candidates are filtered on the tag's first character
+	static constexpr std::size_t table_tag = 4;
+
+	// Calls found( signature, offset ) for every offset any of the signatures starts at, in ascending order
+	template <std::size_t Size, std::size_t Count, class Found>
+	void find_all( const std::span<const std::byte>& rom, const std::array<std::array<std::byte, Size>, Count>& signatures, const std::size_t anchor, Found&& found ) {
+		if ( rom.size() < Size ) {
+			return;
+		}
+
+		const auto* data = rom.data();
+		const auto last = rom.size() - Size; // Last offset a signature fits at
+		const auto test = [&]( const std::size_t offset ) {
+			for ( std::size_t ii = 0; ii < Count; ++ii ) {
+				if ( std::equal( std::cbegin( signatures[ii] ), std::cend( signatures[ii] ), data + offset ) ) {
+					found( ii, offset );
+					return;
+				}
+			}
+		};
+
+		std::size_t offset = 0;
+#ifdef FFV_GBA_SSE2
+		__m128i anchors[Count];
+		for ( std::size_t ii = 0; ii < Count; ++ii ) {
+			anchors[ii] = _mm_set1_epi8( static_cast<char>( signatures[ii][anchor] ) );
+		}
+
+		// Each lane of the chunk is the anchor byte of one of sixteen candidate offsets
+		while ( last >= 15 && offset <= last - 15 ) {
+			const auto chunk = _mm_loadu_si128( reinterpret_cast<const __m128i*>( data + offset + anchor ) );
+
+			auto hits = _mm_setzero_si128();
+			for ( const auto& anchorBytes : anchors ) {
+				hits = _mm_or_si128( hits, _mm_cmpeq_epi8( chunk, anchorBytes ) );
+			}
+
+			auto mask = static_cast<unsigned int>( _mm_movemask_epi8( hits ) );
+			while ( mask ) {
+				test( offset + static_cast<std::size_t>( std::countr_zero( mask ) ) );
+				mask &= mask - 1;
+			}
+			offset += 16;
+		}
+#endif
+		for ( ; offset <= last; ++offset ) {
+			const auto anchorByte = data[offset + anchor];
+			if ( std::any_of( std::cbegin( signatures ), std::cend( signatures ), [anchorByte, anchor]( const auto& signature ) {
+				return signature[anchor] == anchorByte;
+			} ) ) {
+				test( offset );
+			}
+		}
+	}
+
 } // detail
 
-static bool check_nintendo_logo( std::istream& streamSource ) noexcept {
-	static constexpr auto nintendo_logo_tree = make_huff(
+// Built on the first header read rather than at startup
+static const auto& nintendo_logo_tree() {
+	static const auto tree = make_huff(
 		0x40, 0x00, 0x00, 0x00, 0x01, 0x81, 0x82, 0x82, 0x83, 0x0F, 0x83, 0x0C, 0xC3, 0x03, 0x83, 0x01,
 		0x83, 0x04, 0xC3, 0x08, 0x0E, 0x02, 0xC2, 0x0D, 0xC2, 0x07, 0x0B, 0x06, 0x0A, 0x05, 0x09
 	);
+	return tree;
+}
 
-	const auto decompressed = nintendo_logo_tree.decompress4( streamSource, 156 );
-
+static bool check_nintendo_logo( const std::vector<std::byte>& decompressed ) noexcept {
 	std::array<std::byte, 4> word;
 	std::copy( std::cbegin( decompressed ), std::cbegin( decompressed ) + word.size(), std::begin( word ) );
 	auto size = std::bit_cast<std::uint32_t>( word ) >> 8;
@@ -121,7 +227,7 @@ gba::header gba::read_header( std::istream& stream ) noexcept {
 	gba::header header {};
 
 	stream.seekg( 4, std::istream::cur );
-	header.logo_code = check_nintendo_logo( stream );
+	header.logo_code = check_nintendo_logo( nintendo_logo_tree().decompress4( stream, detail::header_offsets::logo_size ) );
 	stream.read( header.software_title.data(), header.software_title.size() );
 	stream.read( header.game_serial.data(), header.game_serial.size() );
 	stream.read( header.maker.data(), header.maker.size() );
@@ -138,6 +244,35 @@ gba::header gba::read_header( std::istream& stream ) noexcept {
 	return header;
 }
 
+gba::header gba::read_header( const std::span<const std::byte>& rom ) noexcept {
+	using offsets = detail::header_offsets;
+
+	gba::header header {};
+	if ( rom.size() < offsets::end ) [[unlikely]] {
+		return header;
+	}
+
+	const auto copy_field = [&rom]( const std::size_t offset, auto& field ) {
+		std::transform( rom.data() + offset, rom.data() + offset + field.size(), std::begin( field ), []( const std::byte b ) {
+			return static_cast<char>( b );
+		} );
+	};
+
+	header.logo_code = check_nintendo_logo( nintendo_logo_tree().decompress4( rom.subspan( offsets::logo, offsets::logo_size ) ) );
+	copy_field( offsets::title, header.software_title );
+	copy_field( offsets::serial, header.game_serial );
+	copy_field( offsets::maker, header.maker );
+	header.fixed = detail::read<std::uint8_t>( rom, offsets::fixed ) == 0x96;
+	const auto device = detail::read<std::uint16_t>( rom, offsets::device );
+	header.version = detail::read<std::uint8_t>( rom, offsets::version );
+	const auto complement = detail::read<std::uint8_t>( rom, offsets::complement );
+
+	header.complement = detail::read_complement( rom.subspan( offsets::title ).first<28>() ) == complement;
+	header.device = static_cast<device_type>( device & 0x7fff );
+	header.debugger = device & 0x8000;
+	return header;
+}
+
 std::istream& gba::find_fonts( std::istream& stream ) noexcept {
 	return find( stream, detail::font_header );
 }
@@ -146,6 +281,24 @@ std::istream& gba::find_texts( std::istream& stream ) noexcept {
 	return find( stream, detail::text_header );
 }
 
+std::size_t gba::find_fonts( const std::span<const std::byte>& rom ) noexcept {
+	return detail::find( rom, detail::font_header );
+}
+
+std::size_t gba::find_texts( const std::span<const std::byte>& rom ) noexcept {
+	return detail::find( rom, detail::text_header );
+}
+
+gba::table_offsets gba::find_tables( const std::span<const std::byte>& rom ) {
+	static constexpr auto signatures = std::array { detail::font_header, detail::text_header };
+
+	table_offsets tables;
+	detail::find_all( rom, signatures, detail::table_tag, [&tables]( const std::size_t signature, const std::size_t offset ) {
+		( signature == 0 ? tables.fonts : tables.texts ).push_back( offset );
+	} );
+	return tables;
+}
+
 gba::font_table gba::read_fonts( std::istream& stream ) {
 	static constexpr auto unknown_byte_count = 256;
 
@@ -192,11 +345,75 @@ gba::font_table gba::read_fonts( std::istream& stream ) {
 	return fontTable;
 }
 
+gba::font_table gba::read_fonts( const std::span<const std::byte>& table ) {
+	const auto view = view_fonts( table );
+
+	font_table fontTable {};
+	fontTable.height = view.height;
+	fontTable.glyphs.reserve( view.glyphs.size() );
+	for ( const auto& glyph : view.glyphs ) {
+		fontTable.glyphs.push_back( { glyph.advance, glyph.stride, std::vector<std::byte>( std::cbegin( glyph.data ), std::cend( glyph.data ) ) } );
+	}
+	return fontTable;
+}
+
+gba::font_view gba::view_fonts( const std::span<const std::byte>& table ) {
+	static constexpr auto unknown_byte_count = 256;
+
+	using header_type = std::remove_const_t<decltype( detail::font_header )>;
+
+	std::size_t offset = 0;
+	if ( detail::read<header_type>( table, offset ) != detail::font_header ) [[unlikely]] {
+		throw std::invalid_argument( "Data is not a font table" );
+	}
+	offset += sizeof( header_type );
+
+	font_view fontView {};
+	fontView.height = detail::read<std::uint8_t>( table, offset++ );
+
+	if ( const auto bitDepth = detail::read<std::uint8_t>( table, offset++ ); bitDepth != 2 ) [[unlikely]] {
+		throw std::invalid_argument( std::string( "Font table has unexpected bit depth (expected 2, got " ) + std::to_string( static_cast<int>( bitDepth ) ) + ")" );
+	}
+
+	const auto glyphCount = detail::read<std::uint16_t>( table, offset );
+	offset += sizeof( std::uint16_t ) + unknown_byte_count;
+
+	fontView.glyphs.resize( glyphCount );
+	fontView.advances.resize( glyphCount );
+	for ( std::size_t ii = 0; ii < glyphCount; ++ii ) {
+		const auto glyphOffset = static_cast<std::size_t>( detail::read<std::uint32_t>( table, offset + ii * sizeof( std::uint32_t ) ) );
+
+		auto& glyph = fontView.glyphs[ii];
+		glyph.advance = detail::read<std::uint8_t>( table, glyphOffset );
+		glyph.stride = detail::read<std::uint8_t>( table, glyphOffset + 1 );
+
+		const auto dataSize = static_cast<std::size_t>( fontView.height ) * glyph.stride;
+		if ( glyphOffset + 2 + dataSize > table.size() ) [[unlikely]] {
+			throw std::out_of_range( "Read past the end of the ROM" );
+		}
+		glyph.data = table.subspan( glyphOffset + 2, dataSize );
+
+		fontView.advances[ii] = glyph.advance;
+	}
+
+	return fontView;
+}
+
+gba::font_view gba::view_fonts( const font_table& fontTable ) {
+	font_view fontView {};
+	fontView.height = fontTable.height;
+	fontView.glyphs.reserve( fontTable.glyphs.size() );
+	fontView.advances.reserve( fontTable.glyphs.size() );
+	for ( const auto& glyph : fontTable.glyphs ) {
+		fontView.glyphs.push_back( { glyph.advance, glyph.stride, glyph.data } );
+		fontView.advances.push_back( glyph.advance );
+	}
+	return fontView;
+}
+
 gba::text_data gba::read_texts( std::istream& stream ) {
 	using header_type = std::remove_const_t<typename decltype( detail::text_header )>;
 
-	const auto textStart = stream.tellg();
-
 	const auto header = detail::read<header_type>( stream );
 	if ( header != detail::text_header ) [[unlikely]] {
 		throw std::invalid_argument( "Stream is not a text table" );
@@ -205,18 +422,56 @@ gba::text_data gba::read_texts( std::istream& stream ) {
 	text_data textData {};
 	detail::read( stream, textData.header );
 
-	textData.offsets.reserve( textData.header.translations * static_cast<std::size_t>( textData.header.textCount ) );
+	// Offsets are little-endian words, the same as the host, so each region is one read
+	textData.offsets.resize( textData.header.translations * static_cast<std::size_t>( textData.header.textCount ) );
+	stream.read( reinterpret_cast<char*>( textData.offsets.data() ), static_cast<std::streamsize>( textData.offsets.size() * sizeof( std::uint32_t ) ) );
 
-	std::generate_n( std::back_inserter( textData.offsets ), textData.offsets.capacity(), [&stream]() {
-		return detail::read<std::uint32_t>( stream );
-	} );
+	textData.data.resize( textData.header.size - sizeof( textData.header ) - textData.offsets.size() * 4 - sizeof( detail::text_header ) );
+	stream.read( reinterpret_cast<char*>( textData.data.data() ), static_cast<std::streamsize>( textData.data.size() ) );
 
-	const auto dataBytes = textData.header.size - sizeof( textData.header ) - textData.offsets.size() * 4 - sizeof( detail::text_header );
-	textData.data.reserve( dataBytes );
+	return textData;
+}
 
-	std::generate_n( std::back_inserter( textData.data ), textData.data.capacity(), [&stream]() {
-		return detail::read<std::byte>( stream );
-	} );
+gba::text_data gba::read_texts( const std::span<const std::byte>& table ) {
+	const auto view = text_view( table );
+
+	text_data textData {};
+	textData.header = view.header();
+
+	textData.offsets.resize( view.size() );
+	std::memcpy( textData.offsets.data(), table.data() + detail::text_offsets_start, textData.offsets.size() * sizeof( std::uint32_t ) );
+
+	const auto text = view.text();
+	textData.data.assign( std::cbegin( text ), std::cend( text ) );
 
 	return textData;
 }
+
+gba::text_view::text_view( const std::span<const std::byte>& table ) : m_table { table } {
+	using signature_type = std::remove_const_t<decltype( detail::text_header )>;
+
+	if ( detail::read<signature_type>( table, 0 ) != detail::text_header ) [[unlikely]] {
+		throw std::invalid_argument( "Data is not a text table" );
+	}
+	m_header = detail::read<header_type>( table, sizeof( signature_type ) );
+
+	m_textStart = detail::text_offsets_start + size() * sizeof( std::uint32_t );
+	if ( m_header.size < m_textStart || m_header.size > table.size() ) [[unlikely]] {
+		throw std::out_of_range( "Read past the end of the ROM" );
+	}
+}
+
+std::uint32_t gba::text_view::offset( const std::size_t index ) const {
+	if ( index >= size() ) [[unlikely]] {
+		throw std::out_of_range( "Text index out of range" );
+	}
+	return detail::read<std::uint32_t>( m_table, detail::text_offsets_start + index * sizeof( std::uint32_t ) );
+}
+
+std::span<const std::byte> gba::text_view::entry( const std::size_t index ) const {
+	const auto start = offset( index );
+	if ( start < m_textStart || start > m_header.size ) [[unlikely]] {
+		throw std::out_of_range( "Text offset outside the table" );
+	}
+	return m_table.subspan( start, m_header.size - start );
+}
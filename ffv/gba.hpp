@@ -4,6 +4,7 @@
 #include <array>
 #include <cstdint>
 #include <istream>
+#include <span>
 #include <vector>
 
 namespace ffv {
@@ -29,11 +30,26 @@ struct header {
 						complement : 1;
 };
 
+inline constexpr auto npos = static_cast<std::size_t>( -1 );
+
 header	read_header( std::istream& stream ) noexcept;
+header	read_header( const std::span<const std::byte>& rom ) noexcept;
 
 std::istream&	find_fonts( std::istream& stream ) noexcept;
 std::istream&	find_texts( std::istream& stream ) noexcept;
 
+// Offset of the table in the ROM image, npos if there is none
+std::size_t	find_fonts( const std::span<const std::byte>& rom ) noexcept;
+std::size_t	find_texts( const std::span<const std::byte>& rom ) noexcept;
+
+// Every table in the ROM image by ascending offset, found in one pass; localized builds carry more than one of each
+struct table_offsets {
+	std::vector<std::size_t>	fonts;
+	std::vector<std::size_t>	texts;
+};
+
+table_offsets	find_tables( const std::span<const std::byte>& rom );
+
 struct font_glyph {
 	std::uint8_t			advance;
 	std::uint8_t			stride;
@@ -46,6 +62,23 @@ struct font_table {
 };
 
 font_table	read_fonts( std::istream& stream );
+font_table	read_fonts( const std::span<const std::byte>& table ); // From the start of the table to the end of the ROM
+
+// Font read in place: glyph bitmaps are spans into the data they came from, which must outlive the view
+struct font_glyph_view {
+	std::uint8_t				advance;
+	std::uint8_t				stride;
+	std::span<const std::byte>	data;
+};
+
+struct font_view {
+	std::uint8_t					height;
+	std::vector<font_glyph_view>	glyphs;
+	std::vector<std::uint8_t>		advances; // Of each glyph, flat for the width lookups
+};
+
+font_view	view_fonts( const std::span<const std::byte>& table ); // From the start of the table to the end of the ROM
+font_view	view_fonts( const font_table& fontTable );
 
 struct text_data {
 	struct header {
@@ -61,6 +94,37 @@ struct text_data {
 };
 
 text_data read_texts( std::istream& stream );
+text_data read_texts( const std::span<const std::byte>& table ); // From the start of the table to the end of the ROM
+
+// Text table read in place: offsets and text are looked up on demand in the data they came from, which must outlive the view
+class text_view {
+public:
+	using header_type = decltype( text_data::header );
+
+	explicit text_view( const std::span<const std::byte>& table ); // From the start of the table to the end of the ROM
+
+	const header_type& header() const noexcept {
+		return m_header;
+	}
+
+	std::size_t size() const noexcept {
+		return m_header.translations * static_cast<std::size_t>( m_header.textCount );
+	}
+
+	// Same bytes as text_data::data
+	std::span<const std::byte> text() const noexcept {
+		return m_table.subspan( m_textStart, m_header.size - m_textStart );
+	}
+
+	std::uint32_t				offset( const std::size_t index ) const; // From the start of the table, as text_data::offsets
+	std::span<const std::byte>	entry( const std::size_t index ) const; // From the entry's offset to the end of the text
+
+protected:
+	std::span<const std::byte>	m_table;
+	header_type					m_header;
+	std::size_t					m_textStart;
+
+};
 
 } // gba
 } // ffv
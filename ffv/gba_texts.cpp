@@ -7,7 +7,7 @@
 
 using namespace ffv;
 
-std::size_t gba::max_text_length( const text_data& textData, std::vector<std::pair<std::size_t, std::size_t>> ranges, const text_table::type& textTable, const font_table& fontTable ) {
+std::size_t gba::max_text_length( const text_view& textData, std::vector<std::pair<std::size_t, std::size_t>> ranges, const text_table::lookup& textTable, const font_view& fontTable ) {
 	static constexpr auto terminate = std::string_view { "`00`" };
 
 	std::size_t max = 0;
@@ -18,21 +18,22 @@ std::size_t gba::max_text_length( const text_data& textData, std::vector<std::pa
 
 			std::size_t length = 0;
 
-			const auto ss = textData.offsets[ii] - textData.offsets.size() * 4 - sizeof( textData.header ) - 8;
-			auto first = std::cbegin( textData.data ) + ss;
-			const auto last = std::cend( textData.data );
+			const auto entry = textData.entry( ii );
+			auto first = std::cbegin( entry );
+			const auto last = std::cend( entry );
 			while ( first != last ) {
 				auto begin = first;
-				const auto it = textTable.find( first, last );
-				++first;
+				const auto found = textTable.find( first, last );
+				if ( first != last ) {
+					++first;
+				}
 
-				if ( it->value().has_value() && std::distance( begin, first ) == 1 ) {
-					if ( it->value().value() == terminate ) {
+				if ( found != text_table::lookup::npos && std::distance( begin, first ) == 1 ) {
+					if ( textTable.value( found ) == terminate ) {
 						break;
 					}
 
-					const auto& glyph = fontTable.glyphs[static_cast<int>( *begin )];
-					length += glyph.advance;
+					length += fontTable.advances[static_cast<std::size_t>( *begin )];
 				} else [[unlikely]] {
 					std::cout << "Warning: Missing AGB character for code ";
 					while ( begin != first ) {
@@ -9,7 +9,7 @@
 namespace ffv {
 namespace gba {
 
-std::size_t max_text_length( const text_data& textData, std::vector<std::pair<std::size_t, std::size_t>> ranges, const text_table::type& textTable, const font_table& fontTable );
+std::size_t max_text_length( const text_view& textData, std::vector<std::pair<std::size_t, std::size_t>> ranges, const text_table::lookup& textTable, const font_view& fontTable );
 
 } // gba
 } // ffv
@@ -0,0 +1,122 @@
+#include "mapped_file.hpp"
+
+#include <utility>
+
+#if defined( _WIN32 )
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace ffv;
+
+#if defined( _WIN32 )
+
+mapped_file::mapped_file( const std::filesystem::path& path ) noexcept : m_data { nullptr }, m_size { 0 }, m_file { nullptr }, m_mapping { nullptr } {
+	const auto file = CreateFileW( path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr );
+	if ( file == INVALID_HANDLE_VALUE ) {
+		return;
+	}
+	m_file = file;
+
+	LARGE_INTEGER size;
+	if ( !GetFileSizeEx( file, &size ) || size.QuadPart <= 0 ) {
+		close();
+		return;
+	}
+
+	// Mapping a zero length file fails, which is why empty files are rejected above
+	m_mapping = CreateFileMappingW( file, nullptr, PAGE_READONLY, 0, 0, nullptr );
+	if ( m_mapping == nullptr ) {
+		close();
+		return;
+	}
+
+	m_data = MapViewOfFile( m_mapping, FILE_MAP_READ, 0, 0, 0 );
+	if ( m_data == nullptr ) {
+		close();
+		return;
+	}
+	m_size = static_cast<std::size_t>( size.QuadPart );
+}
+
+mapped_file::mapped_file( mapped_file&& other ) noexcept : m_data { std::exchange( other.m_data, nullptr ) }, m_size { std::exchange( other.m_size, 0 ) }, m_file { std::exchange( other.m_file, nullptr ) }, m_mapping { std::exchange( other.m_mapping, nullptr ) } {}
+
+mapped_file& mapped_file::operator =( mapped_file&& other ) noexcept {
+	if ( this != &other ) {
+		close();
+		m_data = std::exchange( other.m_data, nullptr );
+		m_size = std::exchange( other.m_size, 0 );
+		m_file = std::exchange( other.m_file, nullptr );
+		m_mapping = std::exchange( other.m_mapping, nullptr );
+	}
+	return *this;
+}
+
+void mapped_file::close() noexcept {
+	if ( m_data ) {
+		UnmapViewOfFile( m_data );
+	}
+	if ( m_mapping ) {
+		CloseHandle( m_mapping );
+	}
+	if ( m_file ) {
+		CloseHandle( m_file );
+	}
+	m_data = nullptr;
+	m_size = 0;
+	m_file = nullptr;
+	m_mapping = nullptr;
+}
+
+#else
+
+mapped_file::mapped_file( const std::filesystem::path& path ) noexcept : m_data { nullptr }, m_size { 0 } {
+	const auto fd = open( path.c_str(), O_RDONLY );
+	if ( fd == -1 ) {
+		return;
+	}
+
+	struct stat status;
+	if ( fstat( fd, &status ) == 0 && status.st_size > 0 ) {
+		const auto size = static_cast<std::size_t>( status.st_size );
+		const auto data = mmap( nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0 );
+		if ( data != MAP_FAILED ) {
+			m_data = data;
+			m_size = size;
+		}
+	}
+
+	// The mapping holds its own reference to the file
+	::close( fd );
+}
+
+mapped_file::mapped_file( mapped_file&& other ) noexcept : m_data { std::exchange( other.m_data, nullptr ) }, m_size { std::exchange( other.m_size, 0 ) } {}
+
+mapped_file& mapped_file::operator =( mapped_file&& other ) noexcept {
+	if ( this != &other ) {
+		close();
+		m_data = std::exchange( other.m_data, nullptr );
+		m_size = std::exchange( other.m_size, 0 );
+	}
+	return *this;
+}
+
+void mapped_file::close() noexcept {
+	if ( m_data ) {
+		munmap( const_cast<void *>( m_data ), m_size );
+	}
+	m_data = nullptr;
+	m_size = 0;
+}
+
+#endif
+
+mapped_file::~mapped_file() noexcept {
+	close();
+}
@@ -0,0 +1,43 @@
+#ifndef FFV_MAPPED_FILE_HPP
+#define FFV_MAPPED_FILE_HPP
+
+#include <cstddef>
+#include <filesystem>
+#include <span>
+
+namespace ffv {
+
+// Read-only view of a whole file mapped into memory; empty if the file is missing, empty or cannot be mapped
+class mapped_file {
+public:
+	explicit mapped_file( const std::filesystem::path& path ) noexcept;
+	mapped_file( mapped_file&& other ) noexcept;
+	mapped_file( const mapped_file& ) = delete;
+	~mapped_file() noexcept;
+
+	mapped_file& operator =( mapped_file&& other ) noexcept;
+	mapped_file& operator =( const mapped_file& ) = delete;
+
+	bool empty() const noexcept {
+		return m_size == 0;
+	}
+
+	std::span<const std::byte> data() const noexcept {
+		return std::span<const std::byte>( static_cast<const std::byte *>( m_data ), m_size );
+	}
+
+protected:
+	void close() noexcept;
+
+	const void *	m_data;
+	std::size_t		m_size;
+#if defined( _WIN32 )
+	void *			m_file;
+	void *			m_mapping;
+#endif
+
+};
+
+} // ffv
+
+#endif // define FFV_MAPPED_FILE_HPP
@@ -0,0 +1,36 @@
+#ifndef FFV_ROM_VIEW_HPP
+#define FFV_ROM_VIEW_HPP
+
+#include <cstddef>
+#include <filesystem>
+#include <span>
+
+#include "mapped_file.hpp"
+
+namespace ffv {
+
+// Whole ROM image mapped read-only; readers take spans of it, so one mapping serves every reader and thread
+class rom_view {
+public:
+	explicit rom_view( const std::filesystem::path& path ) noexcept : m_file { path } {}
+
+	bool empty() const noexcept {
+		return m_file.empty();
+	}
+
+	std::size_t size() const noexcept {
+		return m_file.data().size();
+	}
+
+	std::span<const std::byte> data() const noexcept {
+		return m_file.data();
+	}
+
+protected:
+	mapped_file	m_file;
+
+};
+
+} // ffv
+
+#endif // define FFV_ROM_VIEW_HPP
@@ -2,13 +2,48 @@
 
 #include <algorithm>
 #include <array>
+#include <atomic>
+#include <bit>
+#include <exception>
+#include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <mutex>
 #include <regex>
-#include <sstream>
+#include <thread>
+
+#if defined( __SSE2__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 2 )
+#define FFV_TEXT_MUTATOR_SSE2
+#include <emmintrin.h>
+#endif
+
+#include "aho_corasick.hpp"
 
 using namespace ffv;
 
+// Blocks up to this size are recycled by the line pool; it is far above any line or reflow buffer, since larger blocks come
+// straight from the arena and would only be given back with it
+static constexpr auto line_pool_options = std::pmr::pool_options { 0, 1024 * 1024 };
+
+struct reflow_cache_header {
+	std::array<char, 4>	magic;
+	std::uint32_t		version;
+	std::uint64_t		context; // reflow_context() the memos were made under
+	std::uint32_t		lines;
+	std::uint32_t		padding;
+};
+
+// One per line for the dialog pass, then one per line for the text pass, each followed by result_size bytes of text
+struct reflow_cache_record {
+	std::uint64_t	input_hash;
+	std::uint32_t	input_size;
+	std::uint32_t	result_size; // reflow_cache_no_memo where the line has no memo
+};
+
+static constexpr std::array<char, 4> reflow_cache_magic = { 'F', 'F', 'V', 'R' };
+static constexpr std::uint32_t reflow_cache_version = 1; // Bump whenever a change to the reflows changes what they make of a line
+static constexpr auto reflow_cache_no_memo = static_cast<std::uint32_t>( -1 );
+
 namespace detail {
 
 	template <typename Type, unsigned Count>
@@ -28,71 +63,72 @@ namespace detail {
 		return generate_sequence<char, 26>( 'A' );
 	}
 
-	constexpr auto both_alphabet() noexcept {
-		constexpr auto lower = lower_alphabet();
-		constexpr auto upper = upper_alphabet();
-
-		std::array<char, 52> alphabetic;
-		std::copy( std::cbegin( lower ), std::cend( lower ), std::begin( alphabetic ) );
-		std::copy( std::cbegin( upper ), std::cend( upper ), std::begin( alphabetic ) + 26 );
-		return alphabetic;
-	}
-
 	constexpr auto numbers() noexcept {
 		return generate_sequence<char, 10>( '0' );
 	}
 
-	constexpr bool is_alphabetic( const char c ) noexcept {
-		constexpr auto both = both_alphabet();
+	enum char_class : std::uint8_t {
+		lower = 1 << 0,
+		upper = 1 << 1,
+		digit = 1 << 2
+	};
+
+	// Class bits of every byte, so a character test is one load
+	constexpr auto char_classes = []() {
+		std::array<std::uint8_t, 256> classes {};
+		for ( const auto c : lower_alphabet() ) {
+			classes[static_cast<unsigned char>( c )] |= char_class::lower;
+		}
+		for ( const auto c : upper_alphabet() ) {
+			classes[static_cast<unsigned char>( c )] |= char_class::upper;
+		}
+		for ( const auto c : numbers() ) {
+			classes[static_cast<unsigned char>( c )] |= char_class::digit;
+		}
+		return classes;
+	}();
 
-		return std::find( std::cbegin( both ), std::cend( both ), c ) != std::cend( both );
+	constexpr bool is_class( const char c, const std::uint8_t classes ) noexcept {
+		return ( char_classes[static_cast<unsigned char>( c )] & classes ) != 0;
 	}
 
-	constexpr bool is_alpha_numeric( const char c ) noexcept {
-		constexpr auto digits = numbers();
+	constexpr bool is_alphabetic( const char c ) noexcept {
+		return is_class( c, char_class::lower | char_class::upper );
+	}
 
-		return is_alphabetic( c ) || std::find( std::cbegin( digits ), std::cend( digits ), c ) != std::cend( digits );
+	constexpr bool is_alpha_numeric( const char c ) noexcept {
+		return is_class( c, char_class::lower | char_class::upper | char_class::digit );
 	}
 
 	constexpr bool is_upper( const char c ) noexcept {
-		constexpr auto upper = upper_alphabet();
-
-		return std::find( std::cbegin( upper ), std::cend( upper ), c ) != std::cend( upper );
+		return is_class( c, char_class::upper );
 	}
 
 	constexpr bool is_upper( const std::string_view& sv ) noexcept {
-		constexpr auto lower = lower_alphabet();
-		constexpr auto upper = upper_alphabet();
-
 		bool hasUpper = false;
 		for ( const auto c : sv ) {
-			if ( std::find( std::cbegin( lower ), std::cend( lower ), c ) != std::cend( lower ) ) {
+			if ( is_class( c, char_class::lower ) ) {
 				return false;
 			}
 
-			hasUpper |= ( std::find( std::cbegin( upper ), std::cend( upper ), c ) != std::cend( upper ) );
+			hasUpper |= is_class( c, char_class::upper );
 		}
 
 		return hasUpper;
 	}
 
 	constexpr bool is_lower( const char c ) noexcept {
-		constexpr auto lower = lower_alphabet();
-
-		return std::find( std::cbegin( lower ), std::cend( lower ), c ) != std::cend( lower );
+		return is_class( c, char_class::lower );
 	}
 
 	constexpr bool is_lower( const std::string_view& sv ) noexcept {
-		constexpr auto lower = lower_alphabet();
-		constexpr auto upper = upper_alphabet();
-
 		bool hasLower = false;
 		for ( const auto c : sv ) {
-			if ( std::find( std::cbegin( upper ), std::cend( upper ), c ) != std::cend( upper ) ) {
+			if ( is_class( c, char_class::upper ) ) {
 				return false;
 			}
 
-			hasLower |= ( std::find( std::cbegin( lower ), std::cend( lower ), c ) != std::cend( lower ) );
+			hasLower |= is_class( c, char_class::lower );
 		}
 
 		return hasLower;
@@ -103,14 +139,12 @@ namespace detail {
 			return true;
 		}
 
-		constexpr auto upper = upper_alphabet();
-
-		if ( std::find( std::cbegin( upper ), std::cend( upper ), sv[0] ) == std::cend( upper ) ) {
+		if ( !is_upper( sv[0] ) ) {
 			return false;
 		}
 
 		for ( int ii = 1; ii < sv.size(); ++ii ) {
-			if ( std::find( std::cbegin( upper ), std::cend( upper ), sv[ii] ) != std::cend( upper ) ) {
+			if ( is_upper( sv[ii] ) ) {
 				return false;
 			}
 		}
@@ -118,16 +152,101 @@ namespace detail {
 		return true;
 	}
 
-	std::string to_lower( const std::string& s ) noexcept {
-		auto lower = s;
-		std::transform( std::cbegin( lower ), std::cend( lower ), std::begin( lower ), []( char c ) {
+	// First of Chars at or after pos, npos if there is none; compares sixteen characters at a time where SSE2 is available
+	template <char... Chars>
+	std::size_t find_any_of( const std::string_view& str, std::size_t pos ) noexcept {
+#ifdef FFV_TEXT_MUTATOR_SSE2
+		while ( str.size() >= 16 && pos <= str.size() - 16 ) {
+			const auto chunk = _mm_loadu_si128( reinterpret_cast<const __m128i*>( str.data() + pos ) );
+
+			auto hits = _mm_setzero_si128();
+			( ( hits = _mm_or_si128( hits, _mm_cmpeq_epi8( chunk, _mm_set1_epi8( Chars ) ) ) ), ... );
+
+			const auto mask = static_cast<unsigned int>( _mm_movemask_epi8( hits ) );
+			if ( mask ) {
+				return pos + static_cast<std::size_t>( std::countr_zero( mask ) );
+			}
+			pos += 16;
+		}
+#endif
+		for ( ; pos < str.size(); ++pos ) {
+			if ( ( ( str[pos] == Chars ) || ... ) ) {
+				return pos;
+			}
+		}
+
+		return std::string_view::npos;
+	}
+
+	std::pmr::string to_lower( const std::string_view& s, std::pmr::memory_resource* resource ) {
+		std::pmr::string lower { resource };
+		lower.resize( s.size() );
+		std::transform( std::cbegin( s ), std::cend( s ), std::begin( lower ), []( char c ) {
 			return std::tolower( c );
 		} );
 		return lower;
 	}
 
-	std::string transform_casing( const std::string_view& in, const std::string_view& casing ) noexcept {
-		std::string result;
+	constexpr char fold_case( const char c ) noexcept {
+		return is_upper( c ) ? static_cast<char>( c - 'A' + 'a' ) : c;
+	}
+
+	// Same as to_lower( str ).find( lowerFind, pos ) without lowering str
+	std::size_t find_folded( const std::string_view& str, const std::string_view& lowerFind, std::size_t pos ) noexcept {
+		if ( lowerFind.empty() ) {
+			return pos <= str.size() ? pos : std::string_view::npos;
+		}
+		if ( lowerFind.size() > str.size() ) {
+			return std::string_view::npos;
+		}
+
+		const auto last = str.size() - lowerFind.size(); // Last position a match can start at
+		const auto matches_at = [&]( const std::size_t at ) {
+			for ( std::size_t ii = 0; ii < lowerFind.size(); ++ii ) {
+				if ( fold_case( str[at + ii] ) != lowerFind[ii] ) {
+					return false;
+				}
+			}
+			return true;
+		};
+
+#ifdef FFV_TEXT_MUTATOR_SSE2
+		// Only positions whose first and last characters both fold to the needle's are compared in full
+		const auto lower_chunk = []( const char* data ) {
+			const auto chunk = _mm_loadu_si128( reinterpret_cast<const __m128i*>( data ) );
+			const auto upper = _mm_and_si128( _mm_cmpgt_epi8( chunk, _mm_set1_epi8( 'A' - 1 ) ), _mm_cmplt_epi8( chunk, _mm_set1_epi8( 'Z' + 1 ) ) );
+			return _mm_or_si128( chunk, _mm_and_si128( upper, _mm_set1_epi8( 0x20 ) ) );
+		};
+
+		const auto first = _mm_set1_epi8( lowerFind.front() );
+		const auto tail = _mm_set1_epi8( lowerFind.back() );
+		while ( last >= 15 && pos <= last - 15 ) {
+			const auto firsts = _mm_cmpeq_epi8( lower_chunk( str.data() + pos ), first );
+			const auto lasts = _mm_cmpeq_epi8( lower_chunk( str.data() + pos + lowerFind.size() - 1 ), tail );
+
+			auto mask = static_cast<unsigned int>( _mm_movemask_epi8( _mm_and_si128( firsts, lasts ) ) );
+			while ( mask ) {
+				const auto at = pos + static_cast<std::size_t>( std::countr_zero( mask ) );
+				if ( matches_at( at ) ) {
+					return at;
+				}
+				mask &= mask - 1;
+			}
+			pos += 16;
+		}
+#endif
+		for ( ; pos <= last; ++pos ) {
+			if ( matches_at( pos ) ) {
+				return pos;
+			}
+		}
+
+		return std::string_view::npos;
+	}
+
+	// Writes into result so one buffer serves every replacement
+	void transform_casing( const std::string_view& in, const std::string_view& casing, std::pmr::string& result ) {
+		result.clear();
 		if ( is_upper( casing ) ) {
 			std::transform( std::cbegin( in ), std::cend( in ), std::back_inserter( result ), []( char c ) {
 				return std::toupper( c );
@@ -137,14 +256,11 @@ namespace detail {
 				return std::tolower( c );
 			} );
 		} else {
-			static constexpr auto upper = upper_alphabet();
-
 			result = in;
-			if ( std::find( std::cbegin( upper ), std::cend( upper ), casing[0] ) != std::cend( upper ) ) {
+			if ( is_upper( casing[0] ) ) {
 				result[0] = std::toupper( result[0] );
 			}
 		}
-		return result;
 	}
 
 	auto last_alphabet( const std::string_view& sv ) noexcept {
@@ -154,10 +270,8 @@ namespace detail {
 		return std::distance( it, std::crend( sv ) );
 	}
 
-	std::string name_casing( const std::string_view& in ) noexcept {
-		static constexpr auto upper = upper_alphabet();
-
-		auto result = std::string { in };
+	std::pmr::string name_casing( const std::string_view& in, std::pmr::memory_resource* resource ) {
+		auto result = std::pmr::string { in, resource };
 		if ( !result.empty() ) [[likely]] {
 			result[0] = std::toupper( result[0] );
 
@@ -168,7 +282,7 @@ namespace detail {
 		return result;
 	}
 
-	std::string::size_type dialog_start( const std::string& str, std::string::size_type pos ) noexcept {
+	std::string::size_type dialog_start( const std::pmr::string& str, std::string::size_type pos ) noexcept {
 		static constexpr auto bartz = std::string_view { "`02`" };
 		static constexpr auto colon = ':';
 		static constexpr auto space = ' ';
@@ -190,42 +304,18 @@ namespace detail {
 		return pos;
 	}
 
-	std::string::size_type dialog_end( const std::string& str, std::string::size_type pos ) noexcept {
-		static constexpr auto terminate = std::string_view { "`00`" };
-		static constexpr auto new_line = std::string_view { "`01`" };
-		static constexpr auto colon = ':';
-
-		while ( pos < str.size() ) {
-			if ( pos < str.size() - 4 ) {
-				const auto code = std::string_view( &str[pos], 4 );
-				if ( code == terminate ) {
-					return pos + 4;
-				}
-
-				if ( code == new_line ) {
-					const auto nextDialog = str.find( colon, pos + 4 );
-					if ( nextDialog != std::string::npos ) {
-						return dialog_start( str, nextDialog ) - 1;
-					}
-				}
-			}
-
-			do {
-				++pos;
-			} while ( is_alphabetic( str[pos] ) );
-		}
-
-		return pos - 1;
+	constexpr bool starts_at( const std::string_view& str, const std::string::size_type pos, const std::string_view& sv ) noexcept {
+		return pos <= str.size() && str.substr( pos, sv.size() ) == sv;
 	}
 
-	bool skip_whitespace( const std::string& str, std::string::size_type& pos ) noexcept {
+	bool skip_whitespace( const std::pmr::string& str, std::string::size_type& pos ) noexcept {
 		constexpr auto white_spaces = std::array<std::string_view, 2> {
 			std::string_view { " " }, // space
 			std::string_view { "`01`" } // new line
 		};
 
 		for ( const auto& sv : white_spaces ) {
-			if ( str.find( sv, pos ) == pos ) {
+			if ( starts_at( str, pos, sv ) ) {
 				pos += sv.size();
 				return true;
 			}
@@ -234,31 +324,31 @@ namespace detail {
 		return false;
 	}
 
-	text_range_type find_white_space( const std::string& str, const std::string::size_type pos, int& numSpaces ) noexcept {
-		constexpr auto white_spaces = std::array<std::string_view, 2> {
-			std::string_view { " " }, // space
-			std::string_view { "`01`" } // new line
-		};
+	text_range_type find_white_space( const std::pmr::string& str, const std::string::size_type pos, int& numSpaces ) noexcept {
+		static constexpr auto space = ' ';
+		static constexpr auto new_line = std::string_view { "`01`" };
 
-		std::array<std::string::size_type, white_spaces.size()> spaceStarts;
-		for ( std::size_t ii = 0; ii < white_spaces.size(); ++ii ) {
-			spaceStarts[ii] = str.find( white_spaces[ii], pos );
+		auto begin = find_any_of<space, '`'>( str, pos );
+		while ( begin != std::string::npos && str[begin] != space && !starts_at( str, begin, new_line ) ) {
+			begin = find_any_of<space, '`'>( str, begin + 1 );
+		}
+		if ( begin == std::string::npos ) {
+			return { std::string::npos, std::string::npos };
 		}
 
-		const auto begin = std::min_element( std::cbegin( spaceStarts ), std::cend( spaceStarts ) );
-		auto end = *begin;
+		auto end = begin;
 		while ( skip_whitespace( str, end ) ) {
 			++numSpaces;
 		}
 
-		return { *begin, end };
+		return { begin, end };
 	}
 
-	std::size_t count_line_breaks( const std::string& str, std::string::size_type start, const std::string::size_type end ) noexcept {
+	std::size_t count_line_breaks( const std::pmr::string& str, std::string::size_type start, const std::string::size_type end ) noexcept {
 		constexpr auto line_end = std::string_view { "`01`" };
 		std::size_t count = 0;
 		while ( start < end ) {
-			if ( str.find( line_end, start ) == start ) {
+			if ( starts_at( str, start, line_end ) ) {
 				++count;
 				start += 4;
 			} else {
@@ -268,18 +358,18 @@ namespace detail {
 		return count;
 	}
 
-	std::uint32_t count_trailing_spaces( const std::string& str, std::string::size_type start, const std::string::size_type end ) noexcept {
+	std::uint32_t count_trailing_spaces( const std::pmr::string& str, std::string::size_type start, const std::string::size_type end ) noexcept {
 		constexpr auto line_end = std::string_view { "`01`" };
-		constexpr auto space = std::string_view { " " };
+		constexpr auto space = ' ';
 		std::uint32_t count = 0;
 		while ( start < end ) {
-			if ( str.find( line_end, start ) == start ) {
+			if ( starts_at( str, start, line_end ) ) {
 				count = 0;
 				start += 4;
 				continue;
 			}
 
-			if ( str.find( space, start ) == start ) {
+			if ( str[start] == space ) {
 				++count;
 			}
 			++start;
@@ -287,27 +377,26 @@ namespace detail {
 		return count;
 	}
 
-	auto find_line_end( const std::string& str, const std::string::size_type pos ) noexcept {
-		constexpr auto line_end = std::array<std::string_view, 2> {
-			std::string_view { "`01`" }, // new line
-			std::string_view { "`00`" } // terminate
-		};
+	std::string::size_type find_line_end( const std::pmr::string& str, std::string::size_type pos ) noexcept {
+		constexpr auto new_line = std::string_view { "`01`" };
+		constexpr auto terminate = std::string_view { "`00`" };
 
-		std::array<std::string::size_type, line_end.size()> lineEnds;
-		for ( std::size_t ii = 0; ii < line_end.size(); ++ii ) {
-			lineEnds[ii] = str.find( line_end[ii], pos );
+		for ( pos = str.find( '`', pos ); pos != std::string::npos; pos = str.find( '`', pos + 1 ) ) {
+			if ( starts_at( str, pos, new_line ) || starts_at( str, pos, terminate ) ) {
+				return pos;
+			}
 		}
 
-		return *std::min_element( std::cbegin( lineEnds ), std::cend( lineEnds ) );
+		return std::string::npos;
 	}
 
-	std::string::size_type find_terminal( const std::string& str, std::string::size_type pos ) noexcept {
+	std::string::size_type find_terminal( const std::pmr::string& str, std::string::size_type pos ) noexcept {
 		static constexpr auto period = '.';
 		static constexpr auto exclaim = '!';
 		static constexpr auto question = '?';
 		static constexpr auto quote = '"';
 
-		while ( pos < str.size() ) {
+		for ( pos = find_any_of<period, exclaim, question>( str, pos ); pos != std::string::npos; pos = find_any_of<period, exclaim, question>( str, pos ) ) {
 			if ( ( pos && str[pos] == period && str[pos - 1] != period && str[pos + 1] != quote ) || str[pos] == exclaim || str[pos] == question ) {
 				++pos;
 				if ( str[pos] == quote || is_alpha_numeric( str[pos] ) ) {
@@ -321,7 +410,7 @@ namespace detail {
 		return std::string::npos;
 	}
 
-	int remove_lines( std::string& str, int count ) noexcept {
+	int remove_lines( std::pmr::string& str, int count ) noexcept {
 		static constexpr auto terminate = std::string_view { "`00`" };
 		static constexpr auto new_line = std::string_view { "`01`" };
 		static constexpr auto new_line2 = std::string_view { "`nl`" };
@@ -329,109 +418,108 @@ namespace detail {
 
 		const auto terminates = std::string_view( &str[str.size() - 4], 4 ) == terminate;
 
-		auto pos = str.find( new_line );
-		pos = std::min( pos, str.find( new_line2 ) );
+		std::pmr::string out { str.get_allocator() };
+		out.reserve( str.size() + str.size() / 4 + new_line.size() );
+
+		std::string::size_type copied = 0;
+		auto pos = std::min( str.find( new_line ), str.find( new_line2 ) );
 		while ( pos != std::string::npos ) {
-			if ( str.substr( pos, 4 ) == new_line ) {
-				str.erase( pos, new_line.size() );
-			} else {
-				pos += 4;
+			out.append( str, copied, pos - copied );
+			if ( str.compare( pos, 4, new_line ) != 0 ) {
+				out.append( new_line2 );
 			}
-			
+			pos += 4;
+			copied = pos;
+
 			++count;
 			if ( !terminates && count % 4 == 0 ) {
-				str.insert( pos, box_break );
+				out.append( box_break );
 			}
 
+			// Only the first search takes `nl` into account, the rest look for `01` alone
 			pos = str.find( new_line, pos );
-			pos = std::min( pos, str.find( new_line2, pos ) );
 		}
+		out.append( str, copied );
 
-		const auto code = std::string_view( &str[str.size() - 4], 4 );
+		const auto code = std::string_view( &out[out.size() - 4], 4 );
 		if ( !terminates && code != box_break ) {
-			str += new_line;
+			out += new_line;
 		}
 
+		str.swap( out );
 		return count;
 	}
 
-	void remove_whitespace( std::string& str ) noexcept {
+	constexpr bool is_placeholder( const std::string_view& code ) noexcept {
+		constexpr auto bartz = std::string_view { "`02`" };
+		constexpr auto gil = std::string_view { "`10`" };
+		constexpr auto item = std::string_view { "`11`" };
+		constexpr auto ability = std::string_view { "`12`" };
+
+		return code == bartz || code == gil || code == item || code == ability;
+	}
+
+	// Each pass compacts the string in place, reading ahead of where it writes
+	void remove_whitespace( std::pmr::string& str ) noexcept {
 		static constexpr auto space = ' ';
 		static constexpr auto control = '`';
-		static constexpr auto colon = ':';
 		static constexpr auto ellipsis = std::string_view { ".." };
 
-		static constexpr auto bartz = std::string_view { "`02`" };
-		static constexpr auto gil = std::string_view { "`10`" };
-		static constexpr auto item = std::string_view { "`11`" };
-		static constexpr auto ability = std::string_view { "`12`" };
-
 		// Erase start
-		while ( str[0] == space ) {
-			str.erase( 0, 1 );
-		}
+		str.erase( 0, str.find_first_not_of( space ) );
 
 		// Erase multiples
-		auto start = str.find( space );
-		while ( start != std::string::npos ) {
-			auto end = start;
-			while ( str[end] == space ) {
-				end++;
-			}
-			const auto length = end - start - 1;
-			str.erase( start, length );
-
-			start = str.find( space, start + 1 );
-		}
+		str.erase( std::unique( std::begin( str ), std::end( str ), []( const char a, const char b ) {
+			return a == space && b == space;
+		} ), std::end( str ) );
 
 		// Erase either side of controls
-		start = str.find( space );
-		while ( start != std::string::npos ) {
-			auto end = start + 1;
-			if ( str[end] == control ) {
-				// Check for bartz, gil, etc
-				const auto code = std::string_view( &str[end], 4 );
-				if ( code != bartz && code != gil && code != item && code != ability ) {
-					do {
-						end++;
-					} while ( str[end] != control );
-
-					if ( str[end + 1] == space ) {
-						str.erase( end + 1, 1 );
+		std::size_t write = 0;
+		for ( std::size_t read = 0; read < str.size(); ) {
+			if ( str[read] == space && str[read + 1] == control && !is_placeholder( std::string_view( str ).substr( read + 1, 4 ) ) ) {
+				const auto close = str.find( control, read + 2 );
+				if ( close == std::string::npos ) [[unlikely]] {
+					// Never closed, keep the rest as it is
+					while ( read < str.size() ) {
+						str[write++] = str[read++];
 					}
+					break;
 				}
-			}
 
-			start = str.find( space, start + 1 );
+				while ( read <= close ) {
+					str[write++] = str[read++];
+				}
+				if ( str[read] == space ) {
+					++read;
+				}
+				continue;
+			}
+			str[write++] = str[read++];
 		}
+		str.resize( write );
 
 		// Erase pre-grammar
-		start = str.find( space );
-		while ( start != std::string::npos ) {
-			if ( str[start - 1] != colon && !is_alpha_numeric( str[start - 1] ) && !is_alpha_numeric( str[start + 1] ) ) {
-				if ( str[start - 1] == control ) {
-					const auto code = std::string_view( &str[start - 4], 4 );
-					if ( code != bartz && code != gil && code != item && code != ability ) {
-						str.erase( start, 1 );
-						--start;
-					}
-				}
+		write = 0;
+		for ( std::size_t read = 0; read < str.size(); ++read ) {
+			if ( str[read] == space && write >= 4 && str[write - 1] == control && !is_alpha_numeric( str[read + 1] ) && !is_placeholder( std::string_view( &str[write - 4], 4 ) ) ) {
+				continue;
 			}
-			start = str.find( space, start + 1 );
+			str[write++] = str[read];
 		}
+		str.resize( write );
 
 		// Erase after ellipsis
-		start = str.find( ellipsis );
-		while ( start != std::string::npos ) {
-			if ( str[start + ellipsis.size()] == space ) {
-				str.erase( start + ellipsis.size(), 1 );
+		write = 0;
+		for ( std::size_t read = 0; read < str.size(); ++read ) {
+			if ( str[read] == space && write >= ellipsis.size() && std::string_view( &str[write - ellipsis.size()], ellipsis.size() ) == ellipsis ) {
+				continue;
 			}
-
-			start = str.find( ellipsis, start + 1 );
+			str[write++] = str[read];
 		}
+		str.resize( write );
 	}
 
-	void uppercase_grammar( std::string& str ) noexcept {
+	void uppercase_grammar( std::pmr::string& str ) noexcept {
 		static constexpr auto period = '.';
 
 		auto start = str.find( period );
@@ -443,17 +531,295 @@ namespace detail {
 		}
 	}
 
-	void grammar_line( std::string& str ) noexcept {
+	// One find_replace rule over a line, matching case-insensitively and checking word boundaries in place
+	bool replace_words( std::pmr::string& line, const std::string_view& lowerFind, const std::ptrdiff_t lastAlphabet, const std::string_view& replace, std::pmr::string& replacing ) {
+		bool replacedAny = false;
+		std::size_t find = 0;
+		while ( true ) {
+			find = find_folded( line, lowerFind, find );
+			if ( find == std::string::npos ) {
+				break;
+			}
+
+			if ( find == 0 || !is_alphabetic( line[find - 1] ) && !is_alphabetic( line[find + lastAlphabet] ) ) {
+				transform_casing( replace, std::string_view( line ).substr( find, lowerFind.size() ), replacing );
+				line.replace( find, lowerFind.size(), replacing );
+				find += replace.size();
+
+				replacedAny = true;
+			} else {
+				++find;
+			}
+		}
+
+		return replacedAny;
+	}
+
+	// Whether some placement of b against a has them agree, ignoring case, wherever they overlap. Placements where b starts right after
+	// a letter of a are left out, and with bothWays those where a starts right after a letter of b; replace_words never accepts those
+	bool can_overlap( const std::string_view& a, const std::string_view& b, const bool bothWays ) noexcept {
+		const auto aSize = static_cast<std::ptrdiff_t>( a.size() );
+		const auto bSize = static_cast<std::ptrdiff_t>( b.size() );
+		for ( auto offset = 1 - bSize; offset < aSize; ++offset ) {
+			if ( offset > 0 && is_alphabetic( a[offset - 1] ) ) {
+				continue;
+			}
+			if ( bothWays && offset < 0 && is_alphabetic( b[-offset - 1] ) ) {
+				continue;
+			}
+
+			bool agree = true;
+			const auto last = std::min( aSize, offset + bSize );
+			for ( auto ii = std::max<std::ptrdiff_t>( offset, 0 ); agree && ii < last; ++ii ) {
+				agree = fold_case( a[ii] ) == fold_case( b[ii - offset] );
+			}
+			if ( agree ) {
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	// Whether a replacement starts and ends in a letter exactly where its find does, so word boundary checks next to it see the same either way
+	bool keeps_boundaries( const std::string_view& find, const std::string_view& replace ) noexcept {
+		return !find.empty() && !replace.empty() && is_alphabetic( find.front() ) == is_alphabetic( replace.front() ) && is_alphabetic( find.back() ) == is_alphabetic( replace.back() );
+	}
+
+	// End of the run of rules from first that one pass gives the same result for as running them in turn: no find can overlap another's,
+	// nor an earlier rule's replacement. A rule that fails keeps_boundaries runs on its own
+	std::size_t single_pass_end( const std::span<const std::pair<std::string_view, std::string_view>>& rules, const std::size_t first ) noexcept {
+		auto last = first + 1;
+		if ( !keeps_boundaries( rules[first].first, rules[first].second ) ) {
+			return last;
+		}
+
+		for ( ; last < rules.size(); ++last ) {
+			const auto& [find, replace] = rules[last];
+			if ( !keeps_boundaries( find, replace ) ) {
+				break;
+			}
+
+			const auto conflicts = std::any_of( rules.begin() + first, rules.begin() + last, [&]( const auto& earlier ) {
+				return can_overlap( earlier.first, find, true ) || can_overlap( earlier.second, find, false );
+			} );
+			if ( conflicts ) {
+				break;
+			}
+		}
+
+		return last;
+	}
+
+	// One target_find_replace rule, building the new line in buffer and swapping it in if anything was replaced
+	bool replace_target( std::pmr::string& line, const std::string_view& find, const std::string_view& replace, std::pmr::string& buffer ) noexcept {
+		if ( find.empty() ) {
+			line.insert( 0, replace );
+			return true;
+		}
+
+		const auto lastAlphabet = last_alphabet( find );
+
+		buffer.clear();
+		std::size_t copied = 0;
+		std::size_t cur = 0;
+		while ( true ) {
+			cur = line.find( find, cur );
+			if ( cur == std::string::npos ) {
+				break;
+			}
+
+			// Boundaries are checked against the line as replaced so far, like replacing in place would
+			const auto replacedPos = buffer.size() + ( cur - copied );
+			const auto before = [&]() {
+				return cur > copied ? line[cur - 1] : buffer.back();
+			};
+
+			if ( replacedPos == 0 || !is_alphabetic( before() ) && !is_alphabetic( line[cur + lastAlphabet] ) ) {
+				buffer.append( line, copied, cur - copied );
+				buffer.append( replace );
+				cur += find.size();
+				copied = cur;
+			} else {
+				++cur;
+			}
+		}
+
+		if ( copied == 0 ) {
+			return false;
+		}
+
+		buffer.append( line, copied );
+		line.swap( buffer );
+		return true;
+	}
+
+	// Calls func( index, scratch ) for every index below count on up to threadCount threads; the exception of the lowest failing index is rethrown.
+	// Each thread has its own scratch pool over upstream for the temporaries of the indices it takes, so they are reused with no locking
+	template <class Func>
+	void for_each_index( const std::size_t count, const std::size_t threadCount, std::pmr::memory_resource* upstream, Func&& func ) {
+		if ( threadCount <= 1 || count <= 1 ) {
+			std::pmr::unsynchronized_pool_resource scratch( line_pool_options, upstream );
+			for ( std::size_t ii = 0; ii < count; ++ii ) {
+				func( ii, scratch );
+			}
+			return;
+		}
+
+		static constexpr std::size_t chunk_size = 8;
+
+		std::atomic<std::size_t> next { 0 };
+		std::atomic<bool> failed { false };
+		std::mutex errorMutex;
+		std::size_t errorIndex = count;
+		std::exception_ptr error;
+
+		const auto worker = [&]() {
+			std::pmr::unsynchronized_pool_resource scratch( line_pool_options, upstream );
+			while ( !failed.load( std::memory_order_relaxed ) ) {
+				const auto first = next.fetch_add( chunk_size, std::memory_order_relaxed );
+				if ( first >= count ) {
+					break;
+				}
+
+				const auto last = std::min( first + chunk_size, count );
+				for ( auto ii = first; ii < last; ++ii ) {
+					try {
+						func( ii, scratch );
+					} catch ( ... ) {
+						const auto lock = std::lock_guard( errorMutex );
+						if ( ii < errorIndex ) {
+							errorIndex = ii;
+							error = std::current_exception();
+						}
+						failed = true;
+						break;
+					}
+				}
+			}
+		};
+
+		std::vector<std::thread> threads;
+		const auto workerCount = std::min( threadCount, ( count + chunk_size - 1 ) / chunk_size );
+		threads.reserve( workerCount - 1 );
+		for ( std::size_t ii = 1; ii < workerCount; ++ii ) {
+			threads.emplace_back( worker );
+		}
+		worker();
+		for ( auto& thread : threads ) {
+			thread.join();
+		}
+
+		if ( error ) [[unlikely]] {
+			std::rethrow_exception( error );
+		}
+	}
+
+	// Same mix as boost::hash_combine, widened to 64 bits
+	constexpr std::uint64_t hash_combine( const std::uint64_t seed, const std::uint64_t value ) noexcept {
+		return seed ^ ( value + 0x9e3779b97f4a7c15 + ( seed << 6 ) + ( seed >> 2 ) );
+	}
+
+	template <class Type>
+	Type read_raw( const std::byte * const data ) noexcept {
+		std::array<std::byte, sizeof( Type )> bytes;
+		std::copy_n( data, bytes.size(), std::begin( bytes ) );
+		return std::bit_cast<Type>( bytes );
+	}
+
+	template <class Type>
+	void write_raw( std::ostream& streamDestination, const Type& value ) {
+		const auto bytes = std::bit_cast<std::array<char, sizeof( Type )>>( value );
+		streamDestination.write( bytes.data(), bytes.size() );
+	}
+
+	bool is_key( const text_table::lookup::key_type& key, const text_table::lookup::key_type& other ) noexcept {
+		return std::equal( std::cbegin( key ), std::cend( key ), std::cbegin( other ), std::cend( other ) );
+	}
+
+	void grammar_line( std::pmr::string& str ) noexcept {
 		static constexpr auto new_line = std::string_view { "`01`" };
 
 		auto pos = find_terminal( str, 0 );
+		if ( pos == std::string::npos ) {
+			return;
+		}
+
+		std::pmr::string out { str.get_allocator() };
+		out.reserve( str.size() + new_line.size() * 4 );
+
+		std::string::size_type copied = 0;
 		while ( pos != std::string::npos ) {
-			str.insert( pos, new_line );
+			out.append( str, copied, pos - copied );
+			out.append( new_line );
+			copied = pos;
 
-			pos = find_terminal( str, pos + 4 );
+			pos = find_terminal( str, pos );
 		}
+		out.append( str, copied );
+
+		str.swap( out );
 	}
 
+	// Text with a cursor, edits at the cursor only move the characters the cursor passes over
+	class gap_buffer {
+	public:
+		explicit gap_buffer( std::pmr::string text ) noexcept : m_text { std::move( text ) }, m_gapBegin { 0 }, m_gapEnd { 0 } {}
+
+		std::size_t cursor() const noexcept {
+			return m_gapBegin;
+		}
+
+		// Everything from the cursor on
+		std::string_view after() const noexcept {
+			return std::string_view( m_text ).substr( m_gapEnd );
+		}
+
+		char operator[]( const std::size_t index ) const noexcept {
+			return index < m_gapBegin ? m_text[index] : m_text[index + ( m_gapEnd - m_gapBegin )];
+		}
+
+		void advance( const std::size_t count ) noexcept {
+			std::copy( std::cbegin( m_text ) + m_gapEnd, std::cbegin( m_text ) + m_gapEnd + count, std::begin( m_text ) + m_gapBegin );
+			m_gapBegin += count;
+			m_gapEnd += count;
+		}
+
+		void retreat( const std::size_t count ) noexcept {
+			std::copy_backward( std::cbegin( m_text ) + m_gapBegin - count, std::cbegin( m_text ) + m_gapBegin, std::begin( m_text ) + m_gapEnd );
+			m_gapBegin -= count;
+			m_gapEnd -= count;
+		}
+
+		void insert( const std::string_view& sv ) {
+			if ( m_gapEnd - m_gapBegin < sv.size() ) {
+				const auto grow = std::max( sv.size(), m_text.size() / 2 + 16 );
+				m_text.insert( m_gapEnd, grow, '\0' );
+				m_gapEnd += grow;
+			}
+			std::copy( std::cbegin( sv ), std::cend( sv ), std::begin( m_text ) + m_gapBegin );
+			m_gapBegin += sv.size();
+		}
+
+		void erase_after( const std::size_t count ) noexcept {
+			m_gapEnd += count;
+		}
+
+		std::pmr::string str() const {
+			std::pmr::string text { m_text.get_allocator() };
+			text.reserve( m_text.size() - ( m_gapEnd - m_gapBegin ) );
+			text.append( m_text, 0, m_gapBegin );
+			text.append( m_text, m_gapEnd );
+			return text;
+		}
+
+	protected:
+		std::pmr::string	m_text;
+		std::size_t			m_gapBegin;
+		std::size_t			m_gapEnd;
+
+	};
+
 } // detail
 
 constexpr auto valid_name_chars = std::array<char, 73> {
@@ -471,124 +837,285 @@ constexpr auto valid_name_chars = std::array<char, 73> {
 	'z'
 };
 
-static constexpr auto line_widths = std::array<std::uint32_t, 3> { 217, 217, 212 };
+const text_mutator::window_profile text_mutator::event_window { { 217, 217, 212 }, 3 };
+
 static constexpr auto new_line = std::string_view( "`01`" );
 
-text_mutator::text_mutator( const std::vector<std::byte>& data, const text_table::type& textTable, const gba::font_table& fontTable, const std::size_t itemAdvance, const std::size_t abilityAdvance ) noexcept : m_textTable( textTable ), m_fontTable( fontTable ), m_itemAdvance( itemAdvance ), m_abilityAdvance( abilityAdvance ) {
-	static constexpr auto terminate = std::string_view { "`00`" };
+// Where the colons, new lines and terminators of a line are, so dialog segments are found by lookup instead of by walking the text
+class text_mutator::dialog_index {
+public:
+	static constexpr auto npos = std::string::npos;
 
-	std::stringstream buffer;
-
-	auto first = std::cbegin( data );
-	const auto last = std::cend( data );
-	while ( first != last ) {
-		auto begin = first;
-		const auto it = m_textTable.find( first, last );
-		++first;
-
-		if ( it->value().has_value() ) {
-			const auto value = it->value().value();
-			if ( value == terminate ) {
-				buffer << terminate;
-				m_lines.push_back( buffer.str() );
-				buffer.str( std::string() );
-			} else {
-				buffer << value;
-			}
-		} else [[unlikely]] {
-			std::cout << "Warning: Missing SFC character for code ";
-			while ( begin != first ) {
-				std::cout << std::hex << std::setfill( '0' ) << std::setw( 2 ) << static_cast<int>( *begin++ );
+	// Positions, and the temporaries of find_dialog, are kept in resource
+	dialog_index( const std::pmr::string& str, std::pmr::memory_resource* resource ) : m_str { str }, m_colons( resource ), m_newLines( resource ), m_terminators( resource ) {
+		scan( 0, str.size(), m_colons, m_newLines, m_terminators );
+	}
+
+	const std::pmr::string& str() const noexcept {
+		return m_str;
+	}
+
+	std::pmr::memory_resource* resource() const noexcept {
+		return m_colons.get_allocator().resource();
+	}
+
+	std::size_t next_colon( const std::size_t pos ) const noexcept {
+		const auto it = std::lower_bound( std::cbegin( m_colons ), std::cend( m_colons ), pos );
+		return it == std::cend( m_colons ) ? npos : *it;
+	}
+
+	// Last character of the dialog running on from pos: up to a terminator, or up to the speaker after a new line
+	std::size_t dialog_end( const std::size_t pos ) const noexcept {
+		// Codes flush against the end of the line do not count
+		const auto limit = m_str.size() < 4 ? 0 : m_str.size() - 4;
+
+		const auto terminator = first_before( m_terminators, pos, limit );
+		auto lineBreak = first_before( m_newLines, pos, limit );
+		if ( lineBreak != npos && ( m_colons.empty() || m_colons.back() < lineBreak + 4 ) ) {
+			lineBreak = npos; // No speaker after it
+		}
+
+		if ( lineBreak != npos && ( terminator == npos || lineBreak < terminator ) ) {
+			return detail::dialog_start( m_str, next_colon( lineBreak + 4 ) ) - 1;
+		}
+
+		if ( terminator != npos ) {
+			return terminator + 4;
+		}
+
+		return std::max( pos, m_str.size() ) - 1;
+	}
+
+	// Call after the line has had oldLength characters at first replaced by newLength characters
+	void replaced( const std::size_t first, const std::size_t oldLength, const std::size_t newLength ) {
+		// Codes starting just before first can straddle the edit
+		const auto window = first < 3 ? 0 : first - 3;
+		const auto delta = static_cast<std::ptrdiff_t>( newLength ) - static_cast<std::ptrdiff_t>( oldLength );
+
+		const auto scratch = resource();
+		std::pmr::vector<std::size_t> colons { scratch }, newLines { scratch }, terminators { scratch };
+		scan( window, std::min( first + newLength, m_str.size() ), colons, newLines, terminators );
+
+		splice( m_colons, window, first + oldLength, delta, colons );
+		splice( m_newLines, window, first + oldLength, delta, newLines );
+		splice( m_terminators, window, first + oldLength, delta, terminators );
+	}
+
+protected:
+	static std::size_t first_before( const std::pmr::vector<std::size_t>& positions, const std::size_t pos, const std::size_t limit ) noexcept {
+		const auto it = std::lower_bound( std::cbegin( positions ), std::cend( positions ), pos );
+		return ( it == std::cend( positions ) || *it >= limit ) ? npos : *it;
+	}
+
+	void scan( const std::size_t first, const std::size_t last, std::pmr::vector<std::size_t>& colons, std::pmr::vector<std::size_t>& newLines, std::pmr::vector<std::size_t>& terminators ) const {
+		static constexpr auto colon = ':';
+		static constexpr auto terminate = std::string_view { "`00`" };
+
+		for ( auto pos = detail::find_any_of<colon, '`'>( m_str, first ); pos < last; pos = detail::find_any_of<colon, '`'>( m_str, pos + 1 ) ) {
+			if ( m_str[pos] == colon ) {
+				colons.push_back( pos );
+			} else if ( detail::starts_at( m_str, pos, new_line ) ) {
+				newLines.push_back( pos );
+			} else if ( detail::starts_at( m_str, pos, terminate ) ) {
+				terminators.push_back( pos );
 			}
-			std::cout << '\n';
 		}
 	}
 
-	m_lines.shrink_to_fit();
+	// Swaps the old positions in [first, oldLast) for found, moving the ones after by delta
+	static void splice( std::pmr::vector<std::size_t>& positions, const std::size_t first, const std::size_t oldLast, const std::ptrdiff_t delta, const std::pmr::vector<std::size_t>& found ) {
+		const auto begin = std::lower_bound( std::begin( positions ), std::end( positions ), first );
+		const auto end = std::lower_bound( begin, std::end( positions ), oldLast );
+		std::for_each( end, std::end( positions ), [delta]( std::size_t& pos ) {
+			pos = static_cast<std::size_t>( static_cast<std::ptrdiff_t>( pos ) + delta );
+		} );
+
+		const auto index = std::distance( std::begin( positions ), begin );
+		positions.erase( begin, end );
+		positions.insert( std::begin( positions ) + index, std::cbegin( found ), std::cend( found ) );
+	}
+
+	const std::pmr::string&			m_str;
+	std::pmr::vector<std::size_t>	m_colons;
+	std::pmr::vector<std::size_t>	m_newLines;
+	std::pmr::vector<std::size_t>	m_terminators;
+
+};
+
+text_mutator::text_mutator( const std::vector<std::byte>& data, const text_table::lookup& textTable, const gba::font_view& fontTable, const std::size_t itemAdvance, const std::size_t abilityAdvance ) noexcept : m_arena( std::max<std::size_t>( data.size() * 2, 1 ) ), m_pool( line_pool_options, &m_arena ), m_lines( &m_pool ), m_textTable( textTable ), m_encoder( textTable ), m_fontTable( fontTable ), m_itemAdvance( itemAdvance ), m_abilityAdvance( abilityAdvance ), m_newLineKey( textTable.rfind( new_line ) ), m_bartzKey( textTable.rfind( "`02`" ) ), m_gilKey( textTable.rfind( "`10`" ) ), m_itemKey( textTable.rfind( "`11`" ) ), m_abilityKey( textTable.rfind( "`12`" ) ), m_bartzAdvance( bartz_advance() ), m_gilAdvance( gil_advance() ) {
+	static constexpr auto terminate = std::string_view { "`00`" };
+
+	// Line lengths are known before any text is written, so each line is sized once and decoded straight into place
+	auto missing = text_table::decoder::missing_type();
+	const auto decoder = text_table::decoder( m_textTable, data, terminate );
+	const auto extents = decoder.measure( missing );
+
+	for ( const auto& code : missing ) {
+		std::cout << "Warning: Missing SFC character for code ";
+		for ( const auto byte : code ) {
+			std::cout << std::hex << std::setfill( '0' ) << std::setw( 2 ) << static_cast<int>( byte );
+		}
+		std::cout << '\n';
+	}
+
+	m_lines.reserve( extents.size() );
+	for ( const auto& extent : extents ) {
+		auto& line = m_lines.emplace_back();
+		line.resize( extent.length );
+		decoder.decode( extent, line.data() );
+	}
+
 	m_dialogMarks.resize( m_lines.size() );
+	for ( auto& memos : m_reflowMemos ) {
+		memos.reserve( m_lines.size() );
+		for ( std::size_t ii = 0; ii < m_lines.size(); ++ii ) {
+			memos.push_back( { 0, 0, false, std::pmr::string( &m_pool ) } );
+		}
+	}
+
+	const auto space = m_textTable.rfind( " " );
+	m_spaceAdvance = space.empty() ? 0 : glyph_advance( space[0] );
+
+	m_entryTokens.reserve( m_encoder.size() );
+	for ( std::uint32_t ii = 0; ii < m_encoder.size(); ++ii ) {
+		m_entryTokens.push_back( make_token( m_encoder.key( ii ) ) );
+	}
 }
 
 void text_mutator::find_replace( const std::string_view& find, const std::string_view& replace ) {
-	auto lowerFind = detail::to_lower( std::string { find } );
+	const auto lowerFind = detail::to_lower( find, &m_pool );
 	const auto lastAlphabet = detail::last_alphabet( lowerFind );
 
-	for ( auto& line : m_lines ) {
-		auto lowerLine = detail::to_lower( line );
-
-		std::size_t find = 0;
-		while ( true ) {
-			find = lowerLine.find( lowerFind, find );
-			if ( find == std::string::npos ) {
-				break;
-			}
+	std::pmr::string replacing { &m_pool };
+	for ( std::size_t index = 0; index < m_lines.size(); ++index ) {
+		detail::replace_words( m_lines[index], lowerFind, lastAlphabet, replace, replacing );
+	}
+}
 
-			if ( find == 0 || !detail::is_alphabetic( lowerLine[find - 1] ) && !detail::is_alphabetic( lowerLine[find + lastAlphabet] ) ) {
-				const auto replacing = line.substr( find, lowerFind.size() );
-				line.erase( find, lowerFind.size() );
-				line.insert( find, detail::transform_casing( replace, replacing ) );
-				find += replace.size();
+void text_mutator::find_replace( const std::span<const std::pair<std::string_view, std::string_view>>& rules ) {
+	struct rule_type {
+		std::pmr::string	lowerFind;
+		std::ptrdiff_t		lastAlphabet;
+		std::string_view	replace;
+		std::size_t			groupEnd; // Rules before this run in one pass with this one
+		bool				single; // Runs through replace_words instead
+	};
+
+	struct match_type {
+		std::size_t				start;
+		aho_corasick::size_type	id;
+	};
+
+	aho_corasick matcher( true, &m_pool );
+	std::pmr::vector<rule_type> compiled { &m_pool };
+	compiled.reserve( rules.size() );
+	for ( std::size_t first = 0; first < rules.size(); ) {
+		const auto last = detail::single_pass_end( rules, first );
+		const auto single = !detail::keeps_boundaries( rules[first].first, rules[first].second );
+		for ( ; first < last; ++first ) {
+			auto lowerFind = detail::to_lower( rules[first].first, &m_pool );
+			const auto lastAlphabet = detail::last_alphabet( lowerFind );
+			matcher.insert( lowerFind );
+			compiled.push_back( { std::move( lowerFind ), lastAlphabet, rules[first].second, last, single } );
+		}
+	}
+	matcher.compile();
 
-				lowerLine = detail::to_lower( line );
-			} else {
-				++find;
+	std::pmr::vector<match_type> matches { &m_pool };
+	const auto scan = [&]( const std::pmr::string& line ) {
+		matches.clear();
+		matcher.scan( line, [&]( const aho_corasick::size_type id, const std::size_t end ) {
+			matches.push_back( { end - compiled[id].lowerFind.size(), id } );
+		} );
+		std::sort( std::begin( matches ), std::end( matches ), []( const match_type& a, const match_type& b ) {
+			return a.start < b.start;
+		} );
+	};
+
+	// First rule from rule on that has a match in the last scan; empty finds never show up in a scan, so they always do
+	const auto next_rule = [&]( std::size_t rule ) {
+		auto next = compiled.size();
+		for ( const auto& match : matches ) {
+			if ( match.id >= rule ) {
+				next = std::min<std::size_t>( next, match.id );
 			}
 		}
-	}
-}
+		for ( ; rule < next; ++rule ) {
+			if ( compiled[rule].lowerFind.empty() ) {
+				return rule;
+			}
+		}
+		return next;
+	};
+
+	// Matches of a group never overlap other rules' matches or replacements, so the left to right walk replace_words does for one rule
+	// does for the whole group off the one scan, rebuilding the line once
+	std::pmr::string replacing { &m_pool };
+	std::pmr::string buffer { &m_pool };
+	const auto replace_group = [&]( std::pmr::string& line, const std::size_t first, const std::size_t last ) {
+		buffer.clear();
+		std::size_t copied = 0;
+		for ( const auto& [start, id] : matches ) {
+			if ( id < first || id >= last || start < copied ) {
+				continue;
+			}
 
-bool text_mutator::target_find_replace( const std::uint32_t index, const std::string_view& find, const std::string_view& replace ) {
-	const auto lastAlphabet = detail::last_alphabet( find );
+			const auto& rule = compiled[id];
+			if ( start == 0 || !detail::is_alphabetic( line[start - 1] ) && !detail::is_alphabetic( line[start + rule.lastAlphabet] ) ) {
+				detail::transform_casing( rule.replace, std::string_view( line ).substr( start, rule.lowerFind.size() ), replacing );
+				buffer.append( line, copied, start - copied );
+				buffer.append( replacing );
+				copied = start + rule.lowerFind.size();
+			}
+		}
 
-	auto& line = m_lines[index];
+		if ( copied == 0 ) {
+			return false;
+		}
 
-	if ( find.empty() ) {
-		line.insert( 0, replace );
+		buffer.append( line, copied );
+		line.swap( buffer );
 		return true;
-	}
+	};
 
-	bool replacedAny = false;
-	std::size_t cur = 0;
-	while ( true ) {
-		cur = line.find( find, cur );
-		if ( cur == std::string::npos ) {
-			break;
-		}
+	for ( std::size_t index = 0; index < m_lines.size(); ++index ) {
+		auto& line = m_lines[index];
+		scan( line );
 
-		if ( cur == 0 || !detail::is_alphabetic( line[cur - 1] ) && !detail::is_alphabetic( line[cur + lastAlphabet] ) ) {
-			line.erase( cur, find.size() );
-			line.insert( cur, replace );
-			cur += replace.size();
-			
-			replacedAny |= true;
-		} else {
-			++cur;
+		for ( auto rule = next_rule( 0 ); rule < compiled.size(); rule = next_rule( rule ) ) {
+			const auto& r = compiled[rule];
+			const auto changed = r.single ? detail::replace_words( line, r.lowerFind, r.lastAlphabet, r.replace, replacing ) : replace_group( line, rule, r.groupEnd );
+			if ( changed ) {
+				scan( line ); // Later groups match against the new text
+			}
+			rule = r.groupEnd;
 		}
 	}
+}
 
-	return replacedAny;
+bool text_mutator::target_find_replace( const std::uint32_t index, const std::string_view& find, const std::string_view& replace ) {
+	std::pmr::string buffer { &m_pool };
+	return detail::replace_target( m_lines[index], find, replace, buffer );
 }
 
 void text_mutator::name_case( const std::string_view& name ) {
-	auto lowerFind = detail::to_lower( std::string { name } );
-	const auto nameCased = detail::name_casing( name );
+	const auto lowerFind = detail::to_lower( name, &m_pool );
+	const auto nameCased = detail::name_casing( name, &m_pool );
 	const auto lastAlphabet = detail::last_alphabet( lowerFind );
 
-	for ( auto& line : m_lines ) {
-		auto lowerLine = detail::to_lower( line );
-
+	for ( std::size_t index = 0; index < m_lines.size(); ++index ) {
+		auto& line = m_lines[index];
 		std::size_t find = 0;
 		while ( true ) {
-			find = lowerLine.find( lowerFind, find );
+			find = detail::find_folded( line, lowerFind, find );
 			if ( find == std::string::npos ) {
 				break;
 			}
 
-			if ( find == 0 || !detail::is_alphabetic( lowerLine[find - 1] ) && !detail::is_alphabetic( lowerLine[find + lastAlphabet] ) ) {
-				const auto replacing = line.substr( find, lowerFind.size() );
+			if ( find == 0 || !detail::is_alphabetic( line[find - 1] ) && !detail::is_alphabetic( line[find + lastAlphabet] ) ) {
+				const auto replacing = std::string_view( line ).substr( find, lowerFind.size() );
 				if ( !detail::is_name_case( replacing ) ) {
-					line.erase( find, lowerFind.size() );
-					line.insert( find, nameCased );
-					lowerLine = detail::to_lower( line );
+					line.replace( find, lowerFind.size(), nameCased );
 				}
 				find += nameCased.size();
 			} else {
@@ -601,9 +1128,9 @@ void text_mutator::name_case( const std::string_view& name ) {
 std::uint32_t text_mutator::bartz_advance() const {
 	std::uint32_t widestChar = 0;
 	for ( const auto c : valid_name_chars ) {
-		const auto key = m_textTable.rfind( std::string { c } );
+		const auto key = m_encoder.match( std::string_view( &c, 1 ) ).key;
 		if ( key.size() == 1 ) {
-			const auto advance = m_fontTable.glyphs[static_cast<int>( key[0] )].advance;
+			const auto advance = glyph_advance( key[0] );
 			if ( advance > widestChar ) {
 				widestChar = advance;
 			}
@@ -615,9 +1142,9 @@ std::uint32_t text_mutator::bartz_advance() const {
 std::uint32_t text_mutator::gil_advance() const {
 	std::uint32_t widestChar = 0;
 	for ( const auto c : detail::numbers() ) {
-		const auto key = m_textTable.rfind( std::string { c } );
+		const auto key = m_encoder.match( std::string_view( &c, 1 ) ).key;
 		if ( key.size() == 1 ) {
-			const auto advance = m_fontTable.glyphs[static_cast<int>( key[0] )].advance;
+			const auto advance = glyph_advance( key[0] );
 			if ( advance > widestChar ) {
 				widestChar = advance;
 			}
@@ -626,68 +1153,89 @@ std::uint32_t text_mutator::gil_advance() const {
 	return widestChar * 7;
 }
 
-std::uint32_t text_mutator::measure( const std::string& line, const std::size_t start, const std::size_t end ) const {
-	const auto bartz = m_textTable.rfind( "`02`" );
-	const auto gil = m_textTable.rfind( "`10`" );
-	const auto item = m_textTable.rfind( "`11`" );
-	const auto ability = m_textTable.rfind( "`12`" );
+text_mutator::token text_mutator::make_token( const text_table::encoder::key_type& key ) const noexcept {
+	auto t = token { token_kind::code, 0, 0, 0 };
+	if ( key.size() == 1 ) {
+		t.glyph_advance = glyph_advance( key[0] );
+		t.advance = t.glyph_advance;
+	}
 
-	const auto bartzAdvance = bartz_advance();
-	const auto gilAdvance = gil_advance();
+	if ( detail::is_key( key, m_newLineKey ) ) {
+		t.kind = token_kind::new_line;
+	} else if ( detail::is_key( key, m_bartzKey ) ) {
+		t.kind = token_kind::bartz;
+		t.advance = m_bartzAdvance;
+	} else if ( detail::is_key( key, m_gilKey ) ) {
+		t.kind = token_kind::gil;
+		t.advance = m_gilAdvance;
+	} else if ( detail::is_key( key, m_itemKey ) ) {
+		t.advance = static_cast<std::uint32_t>( m_itemAdvance );
+	} else if ( detail::is_key( key, m_abilityKey ) ) {
+		t.advance = static_cast<std::uint32_t>( m_abilityAdvance );
+	}
 
-	std::uint32_t width = 0;
-	auto begin = std::cbegin( line ) + start;
-	const auto stop = std::cbegin( line ) + end;
-	while ( begin < stop ) {
-		auto end = begin + 1;
-		auto key = m_textTable.rfind( std::string( begin, end ) );
-		while ( key.empty() ) {
-			if ( end == std::cend( line ) ) {
-				break;
-			}
-			++end;
-			key = m_textTable.rfind( std::string( begin, end ) );
+	return t;
+}
+
+text_mutator::token text_mutator::next_token( const std::string_view& line, const std::size_t pos ) const noexcept {
+	constexpr auto box_break = std::string_view { "`bx`" };
+
+	const auto [length, entry] = m_encoder.match_entry( line.substr( pos ) );
+	if ( entry == text_table::encoder::npos ) [[unlikely]] {
+		if ( line.substr( pos ).starts_with( box_break ) ) {
+			return { token_kind::box_break, static_cast<std::uint32_t>( box_break.size() ), 0, 0 };
 		}
+		return { token_kind::missing, static_cast<std::uint32_t>( length ), 0, 0 };
+	}
 
-		if ( key == bartz ) {
-			width += bartzAdvance;
-		} else if ( key == gil ) {
-			width += gilAdvance;
-		} else if ( key == item ) {
-			width += m_itemAdvance;
-		} else if ( key == ability ) {
-			width += m_abilityAdvance;
-		} else if ( key.size() == 1 ) {
-			width += m_fontTable.glyphs[static_cast<int>( key[0] )].advance;
+	auto t = m_entryTokens[entry];
+	t.length = static_cast<std::uint32_t>( length );
+	return t;
+}
+
+std::uint32_t text_mutator::measure( const std::pmr::string& line, const std::size_t start, const std::size_t end ) const {
+	std::uint32_t width = 0;
+	auto pos = start;
+	while ( pos < end ) {
+		const auto t = next_token( line, pos );
+		if ( t.kind == token_kind::box_break || t.kind == token_kind::missing ) {
+			break; // No code, nothing further is measured
 		}
 
-		begin = end;
+		width += t.advance;
+		pos += t.length;
 	}
 
 	return width;
 }
 
-text_range_type text_mutator::find_dialog( const std::string& str, const text_range_type& range, const int markIndex ) const noexcept {
+text_range_type text_mutator::find_dialog( const dialog_index& index, const text_range_type& range, const aho_corasick* marks ) const noexcept {
+	const auto& str = index.str();
 	if ( detail::is_upper( str[range.second] ) ) {
-		const auto end = detail::dialog_end( str, range.second + 1 );
+		const auto end = index.dialog_end( range.second + 1 );
 		return { range.second, end };
 	}
 
-	static constexpr auto colon = ':';
-
-	auto start = str.find( colon, range.second + 1 );
+	auto start = index.next_colon( range.second + 1 );
 	if ( start == std::string::npos ) {
-		if ( markIndex >= 0 ) {
-			const auto marks = m_dialogMarks[markIndex];
-			for ( const auto& m : marks ) {
-				start = std::min( start, str.find( m, range.second ) );
-			}
-
+		if ( marks ) {
+			start = marks->find( str, range.second );
 			if ( start != std::string::npos ) {
-				auto end = detail::dialog_end( str, start + 1 );
-				for ( const auto& m : marks ) {
-					end = std::min( end, str.find( m, start + 1 ) - 5 );
-				}
+				// The first following hit of each mark ends the dialog five characters early; a mark whose first hit is closer to the start than that is ignored
+				auto end = index.dialog_end( start + 1 );
+				std::pmr::vector<bool> seen( marks->size(), false, index.resource() );
+				const auto rest = std::string_view( str ).substr( start + 1 );
+				marks->scan( rest, [&]( const aho_corasick::size_type id, const std::size_t stop ) {
+					if ( seen[id] ) {
+						return;
+					}
+					seen[id] = true;
+
+					const auto found = start + 1 + stop - marks->pattern( id ).size();
+					if ( found >= 5 ) {
+						end = std::min( end, found - 5 );
+					}
+				} );
 				return { start, end };
 			}
 		}
@@ -695,252 +1243,397 @@ text_range_type text_mutator::find_dialog( const std::string& str, const text_ra
 		return { std::string::npos, 0 };
 	}
 
-	auto end = detail::dialog_end( str, start + 1 );
+	auto end = index.dialog_end( start + 1 );
 	start = detail::dialog_start( str, start );
 
 	return { start, end };
 }
 
-void text_mutator::text_reflow() {
-	constexpr auto box_break = std::string_view { "`bx`" };
-	constexpr auto enforced_line_break = std::string_view { "`nl`" };
+void text_mutator::set_window_profile( const window_profile& profile ) {
+	m_window = profile;
 
-	const auto newLine = m_textTable.rfind( std::string( new_line ) );
-	const auto spaceWidth = m_fontTable.glyphs[static_cast<int>( m_textTable.rfind( " " )[0] )].advance;
-
-	int ll = 0;
-	for ( auto& line : m_lines ) {
-		const auto dialog = find_dialog( line, { 0, 0 }, -1 );
-		if ( dialog.first < dialog.second ) {
-			continue;
+	// Every memo was laid out for the old window
+	for ( auto& memos : m_reflowMemos ) {
+		for ( auto& memo : memos ) {
+			memo.valid = false;
 		}
+	}
+}
 
-		bool valign = false;
-		std::vector<bool> alignments;
-		std::size_t start = 0;
-		while ( start < line.size() ) {
-			int count = 0;
-			const auto ws = detail::find_white_space( line, start, count );
-			if ( ws.first == std::string::npos ) {
-				break;
+template <class Func>
+void text_mutator::memoized_reflow( const reflow_pass pass, Func&& reflowLine ) {
+	auto& memos = m_reflowMemos[pass];
+	detail::for_each_index( m_lines.size(), m_threadCount, &m_pool, [&]( const std::size_t index, std::pmr::memory_resource& scratch ) {
+		auto& line = m_lines[index];
+		auto& memo = memos[index];
+
+		// The reflows are a function of the line, its marks and the reflow context alone, so the same input gives the same output
+		const auto hash = reflow_input_hash( pass, index );
+		if ( memo.valid && memo.input_hash == hash && memo.input_size == line.size() ) {
+			if ( line != memo.result ) {
+				line.assign( memo.result );
 			}
+			return;
+		}
+
+		memo.input_hash = hash;
+		memo.input_size = static_cast<std::uint32_t>( line.size() );
+		memo.valid = false; // Until the line is through, in case it throws
+		reflowLine( line, index, scratch );
+		memo.result.assign( line );
+		memo.valid = true;
+	} );
+}
+
+std::uint64_t text_mutator::reflow_input_hash( const reflow_pass pass, const std::size_t index ) const {
+	using hash_type = std::hash<std::string_view>;
+
+	auto hash = static_cast<std::uint64_t>( hash_type {}( m_lines[index] ) );
+	if ( pass == dialog_pass ) {
+		for ( const auto& mark : m_dialogMarks[index] ) {
+			hash = detail::hash_combine( hash, mark.size() );
+			hash = detail::hash_combine( hash, hash_type {}( mark ) );
+		}
+	}
+	return hash;
+}
+
+std::uint64_t text_mutator::reflow_context() const {
+	std::string bytes;
+	const auto append = [&]<class Type>( const Type& value ) {
+		const auto raw = std::bit_cast<std::array<char, sizeof( Type )>>( value );
+		bytes.append( raw.data(), raw.size() );
+	};
+
+	append( reflow_cache_version );
+	for ( const auto width : m_window.line_widths ) {
+		append( width );
+	}
+	append( static_cast<std::uint64_t>( m_window.lines_per_box ) );
+
+	append( static_cast<std::uint64_t>( m_itemAdvance ) );
+	append( static_cast<std::uint64_t>( m_abilityAdvance ) );
+	append( m_bartzAdvance );
+	append( m_gilAdvance );
+	append( m_spaceAdvance );
+	bytes.append( std::cbegin( m_fontTable.advances ), std::cend( m_fontTable.advances ) );
+
+	// Values, their keys and their order are all the reflows see of the table
+	for ( const auto& entry : m_textTable.entries ) {
+		append( entry );
+	}
+	bytes.append( m_textTable.value_pool );
+	for ( const auto key : m_textTable.key_pool ) {
+		append( key );
+	}
+
+	return std::hash<std::string_view> {}( bytes );
+}
+
+bool text_mutator::read_reflow_cache( const std::span<const std::byte>& data ) {
+	if ( data.size() < sizeof( reflow_cache_header ) ) [[unlikely]] {
+		return false;
+	}
+
+	const auto header = detail::read_raw<reflow_cache_header>( data.data() );
+	if ( header.magic != reflow_cache_magic || header.version != reflow_cache_version || header.context != reflow_context() || header.lines != m_lines.size() ) {
+		return false;
+	}
+
+	const auto records = m_lines.size() * m_reflowMemos.size();
+
+	// Walked once to check it is all there, so a cache cut short leaves the memos as they were
+	auto offset = sizeof( reflow_cache_header );
+	for ( std::size_t ii = 0; ii < records; ++ii ) {
+		if ( data.size() - offset < sizeof( reflow_cache_record ) ) [[unlikely]] {
+			return false;
+		}
 
-			const auto newLines = detail::count_line_breaks( line, ws.first, ws.second );
-			const auto spaces = detail::count_trailing_spaces( line, ws.first, ws.second );
-			if ( ws.first == 0 || newLines ) {
-				alignments.push_back( spaces > 2 );
+		const auto record = detail::read_raw<reflow_cache_record>( data.data() + offset );
+		offset += sizeof( reflow_cache_record );
+		if ( record.result_size != reflow_cache_no_memo ) {
+			if ( data.size() - offset < record.result_size ) [[unlikely]] {
+				return false;
 			}
+			offset += record.result_size;
+		}
+	}
 
-			if ( ws.first == 0 && newLines ) {
-				valign = true;
+	offset = sizeof( reflow_cache_header );
+	for ( auto& memos : m_reflowMemos ) {
+		for ( auto& memo : memos ) {
+			const auto record = detail::read_raw<reflow_cache_record>( data.data() + offset );
+			offset += sizeof( reflow_cache_record );
+			if ( record.result_size == reflow_cache_no_memo ) {
+				continue; // Keep whatever this run has already
 			}
 
-			const auto length = ws.second - ws.first;
-			if ( ws.first == 0 ) {
-				// Starts with whitespace, destroy all
-				line.erase( 0, ws.second );
-			} else if ( count > 1 ) {
-				line.erase( ws.first, length );
+			memo.input_hash = record.input_hash;
+			memo.input_size = record.input_size;
+			memo.valid = true;
+			memo.result.assign( reinterpret_cast<const char *>( data.data() + offset ), record.result_size );
+			offset += record.result_size;
+		}
+	}
+	return true;
+}
 
-				// More than 1 whitespace
-				if ( newLines ) {
-					// Has new lines (assumption)
-					line.insert( ws.first, new_line );
-					start = ws.first + new_line.size();
-				} else {
-					// Only spaces
-					line.insert( ws.first, " " );
-					start = ws.first + 1;
-				}
-			} else {
-				start = ws.second;
+void text_mutator::write_reflow_cache( std::ostream& streamDestination ) const {
+	detail::write_raw( streamDestination, reflow_cache_header { reflow_cache_magic, reflow_cache_version, reflow_context(), static_cast<std::uint32_t>( m_lines.size() ), 0 } );
+	for ( const auto& memos : m_reflowMemos ) {
+		for ( const auto& memo : memos ) {
+			detail::write_raw( streamDestination, reflow_cache_record { memo.input_hash, memo.input_size, memo.valid ? static_cast<std::uint32_t>( memo.result.size() ) : reflow_cache_no_memo } );
+			if ( memo.valid ) {
+				streamDestination.write( memo.result.data(), static_cast<std::streamsize>( memo.result.size() ) );
 			}
 		}
+	}
+}
 
-		alignments.resize( detail::count_line_breaks( line, 0, line.size() ) + 1 );
+void text_mutator::text_reflow() {
+	memoized_reflow( text_pass, [&]( std::pmr::string& line, std::size_t, std::pmr::memory_resource& scratch ) {
+		text_reflow_line( line, scratch );
+	} );
+}
 
-		std::size_t lineIndex = 0;
-		start = 0;
-		while ( start < line.size() ) {
-			const auto end = detail::find_line_end( line, start );
-			if ( alignments[lineIndex] ) {
-				const auto width = measure( line, start, end );
-				const auto spare = ( line_widths[lineIndex % line_widths.size()] - width ) / 2;
-				const auto padding = spare / spaceWidth;
+void text_mutator::text_reflow_line( std::pmr::string& line, std::pmr::memory_resource& scratch ) const {
+	const auto dialog = find_dialog( dialog_index( line, &scratch ), { 0, 0 } );
+	if ( dialog.first < dialog.second ) {
+		return;
+	}
 
-				line.insert( start, padding, ' ' );
-				start = end + padding + 4;
+	// Whitespace is collapsed, each finished line centred and its box breaks expanded in the same walk over the text
+	const auto& widths = m_window.line_widths;
+	const auto boxLines = m_window.lines_per_box;
+
+	bool valign = false;
+	std::pmr::vector<bool> alignments( &scratch ); // One per run of whitespace that leads the text or breaks a line, in order
+	std::size_t centreIndex = 0; // Lines centred so far, a terminator ends one as well
+	std::size_t boxIndex = 0; // Line within the current box
+
+	std::pmr::string out { &scratch };
+	out.reserve( line.size() + line.size() / 2 );
+	std::pmr::string current { &scratch }; // Collapsed text of the line being built
+	std::pmr::string laid { &scratch }; // That line centred, before box breaks are expanded
+
+	const auto box_expand = [&]() {
+		std::size_t pos = 0;
+		while ( pos < laid.size() ) {
+			const auto t = next_token( laid, pos );
+
+			if ( t.kind == token_kind::box_break ) {
+				auto breakCount = boxLines - boxIndex;
+				while ( breakCount-- ) {
+					out.append( new_line );
+				}
+
+				boxIndex = 0;
+			} else if ( t.kind == token_kind::missing ) {
+				throw new std::runtime_error( "OMG FIX THIS" );
 			} else {
-				start = end + 4;
+				out.append( laid, pos, t.length );
+				if ( t.kind == token_kind::new_line ) {
+					++boxIndex;
+				}
 			}
+			pos += t.length;
 
-			++lineIndex;
+			if ( boxIndex == boxLines ) {
+				boxIndex = 0;
+			}
 		}
+	};
 
-		if ( valign && alignments.size() == 1 ) {
-			line.insert( 0, new_line );
+	const auto finish_line = [&]( const bool lineBreak, const bool onlyLine ) {
+		laid.clear();
+		if ( valign && onlyLine ) {
+			laid.append( new_line ); // A lone line that was pushed down by leading new lines stays pushed down
 		}
 
-		lineIndex = 0;
-		auto begin = std::cbegin( line );
-		while ( begin != std::cend( line ) ) {
-			auto end = begin + 1;
-			auto key = m_textTable.rfind( std::string( begin, end ) );
-			while ( key.empty() ) {
-				if ( end == std::cend( line ) ) {
-					break;
-				}
-				++end;
-				key = m_textTable.rfind( std::string( begin, end ) );
+		std::size_t start = 0;
+		while ( start < current.size() ) {
+			auto end = detail::find_line_end( current, start );
+			if ( end == std::string::npos ) {
+				end = current.size();
 			}
 
-			if ( key.empty() ) {
-				if ( std::string( begin, begin + box_break.size() ) == box_break ) {
-					auto index = std::distance( std::cbegin( line ), begin );
-					line.erase( index, box_break.size() );
+			// Without a space glyph there is nothing to pad with, so the line stays as it is
+			if ( centreIndex < alignments.size() && alignments[centreIndex] && m_spaceAdvance != 0 ) {
+				const auto width = measure( current, start, end );
+				const auto spare = ( widths[centreIndex % widths.size()] - width ) / 2;
+				laid.append( spare / m_spaceAdvance, ' ' );
+			}
+			laid.append( current, start, std::min( end + 4, current.size() ) - start );
 
-					auto breakCount = 3 - lineIndex;
-					while ( breakCount-- ) {
-						line.insert( index, new_line );
-						index += 4;
-					}
-					end = std::cbegin( line ) + index;
+			start = end + 4;
+			++centreIndex;
+		}
 
-					lineIndex = 0;
-				} else {
-					throw new std::runtime_error( "OMG FIX THIS" );
-				}
-			} else if ( key == newLine ) {
-				++lineIndex;
-			}
+		if ( lineBreak ) {
+			laid.append( new_line );
+		}
 
-			if ( lineIndex == 3 ) {
-				lineIndex = 0;
-			}
+		box_expand();
+		current.clear();
+	};
+
+	bool anyBreak = false;
+	std::size_t start = 0;
+	while ( start < line.size() ) {
+		int count = 0;
+		const auto ws = detail::find_white_space( line, start, count );
+		if ( ws.first == std::string::npos ) {
+			break;
+		}
+
+		const auto leading = ws.first == 0;
+		const auto newLines = detail::count_line_breaks( line, ws.first, ws.second );
+		if ( leading || newLines ) {
+			alignments.push_back( detail::count_trailing_spaces( line, ws.first, ws.second ) > 2 );
+		}
 
-			begin = end;
+		current.append( line, start, ws.first - start );
+		if ( leading ) {
+			// Starts with whitespace, destroy all
+			valign = newLines != 0;
+		} else if ( newLines ) {
+			// Any run with a new line in it becomes a single new line
+			finish_line( true, false );
+			anyBreak = true;
+		} else {
+			current.push_back( ' ' );
 		}
+		start = ws.second;
+	}
+	if ( start < line.size() ) {
+		current.append( line, start );
+	}
+	finish_line( false, !anyBreak );
+
+	// Copied rather than swapped, as the line has to stay in the line pool
+	if ( out != line ) {
+		line.assign( out );
 	}
 }
 
 void text_mutator::dialog_reflow() {
-	constexpr auto box_break = std::string_view { "`bx`" };
-	constexpr auto enforced_line_break = std::string_view { "`nl`" };
-
-	const auto newLine = m_textTable.rfind( std::string( new_line ) );
-	const auto bartz = m_textTable.rfind( "`02`" );
-	const auto gil = m_textTable.rfind( "`10`" );
+	compile_dialog_marks();
 
-	const auto bartzAdvance = bartz_advance();
-	const auto gilAdvance = gil_advance();
+	memoized_reflow( dialog_pass, [&]( std::pmr::string& line, const std::size_t index, std::pmr::memory_resource& scratch ) {
+		const auto matcher = m_dialogMatchers.find( static_cast<int>( index ) );
+		dialog_reflow_line( line, matcher == std::cend( m_dialogMatchers ) ? nullptr : &matcher->second, scratch );
+	} );
+}
 
-	int markIndex = 0;
-	for ( auto& line : m_lines ) {
-		int lineCount = 0;
-		text_range_type pos { 0, 0 };
-		while ( true ) {
-			pos = find_dialog( line, pos, markIndex );
-			if ( pos.first > pos.second ) {
-				break;
-			}
+void text_mutator::compile_dialog_marks() {
+	for ( std::size_t index = 0; index < m_dialogMarks.size(); ++index ) {
+		const auto& marks = m_dialogMarks[index];
+		if ( marks.empty() || m_dialogMatchers.contains( static_cast<int>( index ) ) ) {
+			continue;
+		}
 
-			const auto oldLength = ( pos.second - pos.first ) + 1;
-			const auto oldStr = line.substr( pos.first, oldLength );
-			line.erase( pos.first, oldLength );
+		auto& matcher = m_dialogMatchers.try_emplace( static_cast<int>( index ), false, &m_pool ).first->second;
+		for ( const auto& m : marks ) {
+			matcher.insert( m );
+		}
+		matcher.compile();
+	}
+}
 
-			auto newStr = oldStr;
+void text_mutator::dialog_reflow_line( std::pmr::string& line, const aho_corasick* marks, std::pmr::memory_resource& scratch ) const {
+	constexpr auto enforced_line_break = std::string_view { "`nl`" };
 
-			lineCount = detail::remove_lines( newStr, lineCount );
+	int lineCount = 0;
+	auto index = dialog_index( line, &scratch );
+	text_range_type pos { 0, 0 };
+	while ( true ) {
+		pos = find_dialog( index, pos, marks );
+		if ( pos.first > pos.second ) {
+			break;
+		}
 
-			detail::grammar_line( newStr );
-			detail::remove_whitespace( newStr );
+		const auto oldLength = std::min( ( pos.second - pos.first ) + 1, line.size() - pos.first );
+		auto newStr = std::pmr::string( std::string_view( line ).substr( pos.first, oldLength ), &scratch );
 
-			line.insert( pos.first, newStr );
-			pos.second = pos.first + newStr.size() - 1;
-		}
-		++markIndex;
+		lineCount = detail::remove_lines( newStr, lineCount );
 
-		auto elb = line.find( enforced_line_break );
-		while ( elb != std::string::npos ) {
-			line.erase( elb, enforced_line_break.size() );
-			line.insert( elb, new_line );
-			elb = line.find( enforced_line_break, elb );
-		}
+		detail::grammar_line( newStr );
+		detail::remove_whitespace( newStr );
 
-		int lineIndex = 0;
-		std::uint32_t width = 0;
-		auto begin = std::cbegin( line );
-		while ( begin != std::cend( line ) ) {
-			auto end = begin + 1;
-			auto key = m_textTable.rfind( std::string( begin, end ) );
-			while ( key.empty() ) {
-				if ( end == std::cend( line ) ) {
-					break;
-				}
-				++end;
-				key = m_textTable.rfind( std::string( begin, end ) );
-			}
+		line.replace( pos.first, oldLength, newStr );
+		index.replaced( pos.first, oldLength, newStr.size() );
+		pos.second = pos.first + newStr.size() - 1;
+	}
+	auto elb = line.find( enforced_line_break );
+	while ( elb != std::string::npos ) {
+		line.replace( elb, enforced_line_break.size(), new_line );
+		elb = line.find( enforced_line_break, elb );
+	}
 
-			if ( key.empty() ) {
-				if ( std::string( begin, begin + box_break.size() ) == box_break ) {
-					auto index = std::distance( std::cbegin( line ), begin );
-					line.erase( index, box_break.size() );
+	const auto& widths = m_window.line_widths;
+	const auto boxLines = m_window.lines_per_box;
 
-					auto breakCount = 3 - lineIndex;
-					while ( breakCount-- ) {
-						line.insert( index, new_line );
-						index += 4;
-					}
-					end = std::cbegin( line ) + index;
+	std::size_t lineIndex = 0;
+	std::uint32_t width = 0;
+	auto text = detail::gap_buffer( std::move( line ) );
+	while ( !text.after().empty() ) {
+		const auto t = next_token( text.after(), 0 );
 
-					lineIndex = 0;
-					width = 0;
-				} else {
-					throw new std::runtime_error( "OMG FIX THIS" );
-				}
-			} else if ( key == newLine ) {
-				++lineIndex;
-				width = 0;
-			} else if ( key.size() == 1 || key == bartz || key == gil ) {
-				if ( key == bartz ) {
-					width += bartzAdvance;
-				} else if ( key == gil ) {
-					width += gilAdvance;
-				} else {
-					width += m_fontTable.glyphs[static_cast<int>( key[0] )].advance;
-				}
+		if ( t.kind == token_kind::box_break ) {
+			text.erase_after( t.length );
 
-				if ( width > line_widths[lineIndex] ) {
-					while ( *begin != ' ' ) {
-						--begin;
-					}
+			auto breakCount = boxLines - lineIndex;
+			while ( breakCount-- ) {
+				text.insert( new_line );
+			}
 
-					auto index = std::distance( std::cbegin( line ), begin );
-					if ( index > 2 && line[index - 1] != ' ' && line[index - 2] == ' ' ) {
-						index -= 2;
-					}
+			lineIndex = 0;
+			width = 0;
+		} else if ( t.kind == token_kind::missing ) {
+			throw new std::runtime_error( "OMG FIX THIS" );
+		} else if ( t.kind == token_kind::new_line ) {
+			text.advance( t.length );
+			++lineIndex;
+			width = 0;
+		} else {
+			// Dialog only makes room for the expanded name and gil, any other code is as wide as its glyph
+			if ( t.kind == token_kind::bartz || t.kind == token_kind::gil ) {
+				width += t.advance;
+			} else {
+				width += t.glyph_advance;
+			}
 
-					line.erase( index, 1 );
-					line.insert( index, new_line );
-					line.insert( index + 4, " " );
-					end = std::cbegin( line ) + index + 4;
+			if ( width > widths[lineIndex % widths.size()] ) {
+				// Break at the previous space, which carries on to start the new line
+				auto index = text.cursor();
+				while ( text[index] != ' ' ) {
+					--index;
+				}
 
-					++lineIndex;
-					width = 0;
+				if ( index > 2 && text[index - 1] != ' ' && text[index - 2] == ' ' ) {
+					index -= 2;
 				}
-			}
 
-			if ( lineIndex == 3 ) {
-				lineIndex = 0;
+				text.retreat( text.cursor() - index );
+				text.insert( new_line );
+
+				++lineIndex;
+				width = 0;
+			} else {
+				text.advance( t.length );
 			}
+		}
 
-			begin = end;
+		if ( lineIndex == boxLines ) {
+			lineIndex = 0;
 		}
 	}
+	line = text.str();
 }
 
 void text_mutator::battle_bartz() {
-	for ( auto& line : m_lines ) {
+	for ( std::size_t index = 0; index < m_lines.size(); ++index ) {
+		auto& line = m_lines[index];
 		if ( line.starts_with( '"' ) ) {
 			line.erase( 0, 1 );
 			line.insert( 0, "`02`: " );
@@ -1,9 +1,17 @@
 #ifndef FFV_TEXT_MUTATOR_HPP
 #define FFV_TEXT_MUTATOR_HPP
 
+#include <array>
+#include <memory_resource>
+#include <ostream>
+#include <span>
+#include <string>
 #include <string_view>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
+#include "aho_corasick.hpp"
 #include "text_table.hpp"
 #include "gba.hpp"
 
@@ -13,38 +21,133 @@ using text_range_type = std::pair<std::string::size_type, std::string::size_type
 
 class text_mutator {
 public:
-	text_mutator( const std::vector<std::byte>& data, const text_table::type& textTable, const gba::font_table& fontTable, const std::size_t itemAdvance, const std::size_t abilityAdvance ) noexcept;
+	// Window the reflows lay text out for; line widths repeat down each box
+	struct window_profile {
+		std::vector<std::uint32_t>	line_widths; // Pixels
+		std::size_t					lines_per_box;
+	};
+
+	static const window_profile event_window;
+
+	text_mutator( const std::vector<std::byte>& data, const text_table::lookup& textTable, const gba::font_view& fontTable, const std::size_t itemAdvance, const std::size_t abilityAdvance ) noexcept;
 
 	void	find_replace( const std::string_view& find, const std::string_view& replace );
+	void	find_replace( const std::span<const std::pair<std::string_view, std::string_view>>& rules ); // Same as each rule in turn
 	bool	target_find_replace( const std::uint32_t index, const std::string_view& find, const std::string_view& replace );
 	void	name_case( const std::string_view& name );
 	void	dialog_reflow();
 	void	text_reflow();
 	void	battle_bartz();
 
+	// Lines reflow independently, so the reflows can share them out over threads; the output is the same for any count
+	void set_thread_count( const std::size_t count ) noexcept {
+		m_threadCount = count ? count : 1;
+	}
+
+	void set_window_profile( const window_profile& profile );
+
 	void mark_dialog( const int lineId, const std::string_view& search ) {
 		m_dialogMarks[lineId].push_back( search );
+		m_dialogMatchers.erase( lineId ); // Recompiled with the new mark by the next dialog_reflow
 	}
 
+	// What each reflow made of each line, so a later run replays the lines that come to the reflows the same as before. A cache made
+	// for a different window, font, table or line count is ignored; returns whether it was taken
+	bool	read_reflow_cache( const std::span<const std::byte>& data );
+	void	write_reflow_cache( std::ostream& streamDestination ) const;
+
 	const auto& lines() const noexcept {
 		return m_lines;
 	}
 
 protected:
-	text_range_type	find_dialog( const std::string& str, const text_range_type& range, const int markIndex = -1 ) const noexcept;
+	enum reflow_pass : std::uint8_t {
+		dialog_pass,
+		text_pass,
+		reflow_pass_count
+	};
+
+	// A line as a reflow pass left it, replayed whenever the pass is given the same line (and dialog marks) again
+	struct reflow_memo {
+		std::uint64_t		input_hash; // Of the line before the pass, and of its dialog marks for the dialog pass
+		std::uint32_t		input_size;
+		bool				valid;
+		std::pmr::string	result;
+	};
+
+	template <class Func>
+	void			memoized_reflow( const reflow_pass pass, Func&& reflowLine );
+	std::uint64_t	reflow_input_hash( const reflow_pass pass, const std::size_t index ) const;
+	std::uint64_t	reflow_context() const; // Hash of everything besides the line that the reflows read
+
+	// Only what the measuring and reflow loops tell apart
+	enum class token_kind : std::uint8_t {
+		code, // Any other table code
+		new_line,
+		box_break, // `bx`, expanded by the reflows
+		missing, // Text with no table code, runs to the end of the line
+		bartz,
+		gil
+	};
+
+	// The table code matched at a position of a line's text, with the widths worked out once per table entry
+	struct token {
+		token_kind		kind;
+		std::uint32_t	length; // Characters of text
+		std::uint32_t	advance; // Pixels when measured; placeholders take the room of their widest expansion
+		std::uint32_t	glyph_advance; // Pixels of the code's own glyph, zero unless the code is a single byte
+	};
 
-	std::uint32_t measure( const std::string& line, const std::size_t start, const std::size_t end ) const;
+	token			next_token( const std::string_view& line, const std::size_t pos ) const noexcept;
+	token			make_token( const text_table::encoder::key_type& key ) const noexcept;
+
+	class dialog_index;
+
+	text_range_type	find_dialog( const dialog_index& index, const text_range_type& range, const aho_corasick* marks = nullptr ) const noexcept;
+
+	void	compile_dialog_marks();
+	// Temporaries come from scratch, the thread's own pool
+	void	dialog_reflow_line( std::pmr::string& line, const aho_corasick* marks, std::pmr::memory_resource& scratch ) const;
+	void	text_reflow_line( std::pmr::string& line, std::pmr::memory_resource& scratch ) const;
+
+	std::uint32_t measure( const std::pmr::string& line, const std::size_t start, const std::size_t end ) const;
+
+	// Width of a single byte code's glyph, zero past the end of the font
+	std::uint32_t glyph_advance( const std::byte code ) const noexcept {
+		const auto index = static_cast<std::size_t>( code );
+		return index < m_fontTable.advances.size() ? m_fontTable.advances[index] : 0;
+	}
 
 	std::uint32_t bartz_advance() const;
 	std::uint32_t gil_advance() const;
 
-	std::vector<std::string>	m_lines;
-	const text_table::type&		m_textTable;
-	const gba::font_table&		m_fontTable;
+	// Lines and the strings rewritten from them are carved out of one arena; the pool takes freed blocks back for reuse
+	std::pmr::monotonic_buffer_resource		m_arena;
+	std::pmr::synchronized_pool_resource	m_pool; // Reflows allocate from several threads at once
+	std::pmr::vector<std::pmr::string>		m_lines;
+
+	const text_table::lookup	m_textTable;
+	const text_table::encoder	m_encoder;
+	const gba::font_view&		m_fontTable;
 	const std::size_t			m_itemAdvance;
 	const std::size_t			m_abilityAdvance;
 
+	const text_table::lookup::key_type	m_newLineKey;
+	const text_table::lookup::key_type	m_bartzKey;
+	const text_table::lookup::key_type	m_gilKey;
+	const text_table::lookup::key_type	m_itemKey;
+	const text_table::lookup::key_type	m_abilityKey;
+	const std::uint32_t					m_bartzAdvance;
+	const std::uint32_t					m_gilAdvance;
+	std::uint32_t						m_spaceAdvance;
+	std::vector<token>					m_entryTokens; // Kind and advances of each encoder entry, worked out once
+
 	std::vector<std::vector<std::string_view>>	m_dialogMarks;
+	std::unordered_map<int, aho_corasick>		m_dialogMatchers; // All the marks of a line in one matcher, for marked lines only
+	std::size_t									m_threadCount { 1 };
+	window_profile								m_window { event_window };
+
+	std::array<std::vector<reflow_memo>, reflow_pass_count>	m_reflowMemos; // Per pass, per line
 };
 
 } // ffv
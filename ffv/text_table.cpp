@@ -1,7 +1,52 @@
 #include "text_table.hpp"
 
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <unordered_map>
+
+#include "crc.hpp"
+#include "mapped_file.hpp"
+
 using namespace ffv;
 
+struct compiled_header {
+	std::array<char, 4>	magic;
+	std::uint32_t		version;
+	std::uint32_t		source; // crc32 of the .tbl text
+	std::uint32_t		nodes; // Not counting the root
+	std::uint32_t		pool; // Bytes of value text following the nodes
+};
+
+struct compiled_node {
+	std::uint32_t				parent;
+	std::uint32_t				value_offset;
+	std::uint32_t				value_size; // compiled_no_value for nodes without a value
+	std::byte					key;
+	std::array<std::byte, 3>	padding;
+};
+
+static constexpr std::array<char, 4> compiled_magic = { 'F', 'F', 'V', 'T' };
+static constexpr std::uint32_t compiled_version = 1;
+static constexpr auto compiled_no_value = static_cast<std::uint32_t>( -1 );
+
+template <class Type>
+static Type read_raw( const std::byte * const data ) noexcept {
+	std::array<std::byte, sizeof( Type )> bytes;
+	std::copy_n( data, bytes.size(), std::begin( bytes ) );
+	return std::bit_cast<Type>( bytes );
+}
+
+template <class Type>
+static void write_raw( std::ostream& streamDestination, const Type& value ) {
+	const auto bytes = std::bit_cast<std::array<char, sizeof( Type )>>( value );
+	streamDestination.write( bytes.data(), bytes.size() );
+}
+
 static bool is_invalid_hex( const std::string& s ) noexcept {
 	return s.find_first_not_of( "0123456789abcdefABCDEF" ) != std::string::npos;
 }
@@ -36,5 +81,340 @@ text_table::const_type text_table::read( std::istream& streamSource ) {
 		tree.insert( std::cbegin( key ), std::cend( key ), value );
 	}
 
+	tree.freeze();
+	return tree;
+}
+
+text_table::const_type text_table::load( const std::filesystem::path& path ) {
+	const auto source = mapped_file( path );
+	if ( source.empty() ) [[unlikely]] {
+		return text_table::type();
+	}
+
+	const auto sourceBytes = source.data();
+	const auto sourceHash = static_cast<std::uint32_t>( crc32().write( std::cbegin( sourceBytes ), std::cend( sourceBytes ) ) );
+
+	auto compiledPath = path;
+	compiledPath += ".bin";
+	if ( const auto compiled = mapped_file( compiledPath ); !compiled.empty() ) {
+		const auto tree = read_compiled( compiled.data(), sourceHash );
+		if ( !tree.empty() ) [[likely]] {
+			return tree;
+		}
+	}
+
+	auto streamSource = std::istringstream( std::string( reinterpret_cast<const char *>( sourceBytes.data() ), sourceBytes.size() ) );
+	const auto tree = read( streamSource );
+	if ( !tree.empty() ) {
+		auto streamDestination = std::ofstream( compiledPath, std::ostream::binary | std::ostream::trunc );
+		write_compiled( streamDestination, tree, sourceHash );
+		streamDestination.close();
+		if ( !streamDestination ) [[unlikely]] {
+			// The table still loads, it is just parsed again on every run until the cache can be written
+			std::cout << "Warning: Could not write compiled text table " << compiledPath.string() << '\n';
+		}
+	}
 	return tree;
 }
+
+void text_table::write_compiled( std::ostream& streamDestination, const type& textTable, const std::uint32_t sourceHash ) {
+	std::vector<compiled_node> nodes;
+	nodes.reserve( textTable.size() - 1 );
+
+	std::string pool;
+	auto it = textTable.cbegin();
+	for ( ++it; it != textTable.cend(); ++it ) {
+		auto n = compiled_node { it->parent(), 0, compiled_no_value, it->key(), {} };
+		if ( it->value().has_value() ) {
+			const auto& value = it->value().value();
+			n.value_offset = static_cast<std::uint32_t>( pool.size() );
+			n.value_size = static_cast<std::uint32_t>( value.size() );
+			pool.append( value );
+		}
+		nodes.push_back( n );
+	}
+
+	write_raw( streamDestination, compiled_header { compiled_magic, compiled_version, sourceHash, static_cast<std::uint32_t>( nodes.size() ), static_cast<std::uint32_t>( pool.size() ) } );
+	for ( const auto& n : nodes ) {
+		write_raw( streamDestination, n );
+	}
+	streamDestination.write( pool.data(), pool.size() );
+}
+
+text_table::const_type text_table::read_compiled( const std::span<const std::byte>& data, const std::uint32_t sourceHash ) {
+	if ( data.size() < sizeof( compiled_header ) ) [[unlikely]] {
+		return text_table::type();
+	}
+
+	const auto header = read_raw<compiled_header>( data.data() );
+	if ( header.magic != compiled_magic || header.version != compiled_version || header.source != sourceHash ) {
+		return text_table::type();
+	}
+
+	const auto poolOffset = sizeof( compiled_header ) + std::size_t { header.nodes } * sizeof( compiled_node );
+	if ( data.size() != poolOffset + header.pool ) [[unlikely]] {
+		return text_table::type();
+	}
+	const auto pool = std::string_view( reinterpret_cast<const char *>( data.data() + poolOffset ), header.pool );
+
+	text_table::type tree;
+	tree.reserve( header.nodes + 1 );
+	for ( std::uint32_t ii = 0; ii < header.nodes; ++ii ) {
+		const auto n = read_raw<compiled_node>( data.data() + sizeof( compiled_header ) + std::size_t { ii } * sizeof( compiled_node ) );
+
+		// Record ii is node ii + 1, and every parent comes before its children
+		if ( n.parent > ii ) [[unlikely]] {
+			return text_table::type();
+		}
+
+		if ( n.value_size == compiled_no_value ) {
+			tree.append( n.parent, n.key, std::nullopt );
+			continue;
+		}
+
+		if ( n.value_offset > pool.size() || n.value_size > pool.size() - n.value_offset ) [[unlikely]] {
+			return text_table::type();
+		}
+		tree.append( n.parent, n.key, std::string( pool.substr( n.value_offset, n.value_size ) ) );
+	}
+
+	tree.freeze();
+	return tree;
+}
+
+std::vector<std::byte> text_table::lookup::code_of( std::uint32_t node ) const {
+	std::size_t depth = 0;
+	for ( auto ii = node; ii != 0; ii = code_parents[ii] ) {
+		++depth;
+	}
+
+	std::vector<std::byte> code( depth );
+	while ( node != 0 ) {
+		code[--depth] = code_keys[node];
+		node = code_parents[node];
+	}
+
+	return code;
+}
+
+template <class Key>
+text_table::lookup_table::trie_storage<Key> text_table::lookup_table::make_trie( const std::vector<std::uint32_t>& parents, const std::vector<Key>& keys, std::vector<std::uint32_t> entries ) {
+	trie_storage<Key> trie;
+
+	// Children sit together in index order, same as tree::freeze packs them
+	trie.child_offsets.assign( parents.size() + 1, 0 );
+	for ( std::size_t node = 1; node < parents.size(); ++node ) {
+		++trie.child_offsets[parents[node] + 1];
+	}
+	for ( std::size_t node = 1; node < trie.child_offsets.size(); ++node ) {
+		trie.child_offsets[node] += trie.child_offsets[node - 1];
+	}
+
+	auto next = trie.child_offsets;
+	trie.child_keys.resize( parents.size() - 1 );
+	trie.child_nodes.resize( parents.size() - 1 );
+	trie.dispatch.assign( 256, lookup::npos );
+	for ( std::size_t node = 1; node < parents.size(); ++node ) {
+		const auto slot = next[parents[node]]++;
+		trie.child_keys[slot] = keys[node];
+		trie.child_nodes[slot] = static_cast<std::uint32_t>( node );
+
+		if ( parents[node] == 0 ) {
+			trie.dispatch[static_cast<unsigned char>( keys[node] )] = static_cast<std::uint32_t>( node );
+		}
+	}
+
+	trie.entries = std::move( entries );
+	return trie;
+}
+
+text_table::lookup_table::lookup_table( const type& textTable ) {
+	std::unordered_map<std::string_view, std::uint32_t> entryOf;
+
+	// Codes keep the tree's node numbering; a value's entry is made at its lowest node, whose code is the one rfind gives
+	std::vector<std::uint32_t> codeEntries;
+	codeEntries.reserve( textTable.size() );
+	m_codeParents.reserve( textTable.size() );
+	m_codeKeys.reserve( textTable.size() );
+	for ( auto it = textTable.cbegin(); it != textTable.cend(); ++it ) {
+		m_codeParents.push_back( it->parent() );
+		m_codeKeys.push_back( it->key() );
+
+		if ( !it->value().has_value() ) {
+			codeEntries.push_back( lookup::npos );
+			continue;
+		}
+
+		const auto& value = it->value().value();
+		const auto [found, inserted] = entryOf.try_emplace( value, static_cast<std::uint32_t>( m_entries.size() ) );
+		if ( inserted ) {
+			const auto code = textTable.key_of( it );
+			m_entries.push_back( { static_cast<std::uint32_t>( m_valuePool.size() ), static_cast<std::uint32_t>( value.size() ), static_cast<std::uint32_t>( m_keyPool.size() ), static_cast<std::uint32_t>( code.size() ) } );
+			m_valuePool.insert( std::end( m_valuePool ), std::cbegin( value ), std::cend( value ) );
+			m_keyPool.insert( std::end( m_keyPool ), std::cbegin( code ), std::cend( code ) );
+		}
+		codeEntries.push_back( found->second );
+	}
+	m_codes = make_trie( m_codeParents, m_codeKeys, std::move( codeEntries ) );
+
+	// The value trie is built as a tree first so shared prefixes share nodes, then flattened the same way
+	auto values = tree<char, std::uint32_t>();
+	for ( std::uint32_t ii = 0; ii < m_entries.size(); ++ii ) {
+		const auto& e = m_entries[ii];
+		if ( e.value_size ) {
+			const auto first = std::cbegin( m_valuePool ) + e.value_offset;
+			values.insert( first, first + e.value_size, ii );
+		}
+	}
+
+	std::vector<std::uint32_t> valueParents;
+	std::vector<char> valueKeys;
+	std::vector<std::uint32_t> valueEntries;
+	for ( auto it = values.cbegin(); it != values.cend(); ++it ) {
+		valueParents.push_back( it->parent() );
+		valueKeys.push_back( it->key() );
+		valueEntries.push_back( it->value().value_or( lookup::npos ) );
+	}
+	m_values = make_trie( valueParents, valueKeys, std::move( valueEntries ) );
+
+	m_view = lookup { m_codes.view(), m_codeParents, m_codeKeys, m_values.view(), m_entries, std::string_view( m_valuePool.data(), m_valuePool.size() ), m_keyPool };
+}
+
+text_table::encoder::match_type text_table::encoder::match( const std::string_view& str ) const noexcept {
+	const auto [length, entry] = match_entry( str );
+	if ( entry == npos ) [[unlikely]] {
+		return { length, key_type() };
+	}
+
+	return { length, key( entry ) };
+}
+
+text_table::encoder::entry_match_type text_table::encoder::match_entry( const std::string_view& str ) const noexcept {
+	auto first = std::cbegin( str );
+	const auto node = m_textTable.values.find_longest( first, std::cend( str ) );
+	if ( node == npos ) [[unlikely]] {
+		return { str.size(), npos };
+	}
+
+	return { static_cast<std::string_view::size_type>( std::distance( std::cbegin( str ), first ) + 1 ), m_textTable.values.entries[node] };
+}
+
+text_table::decoder::decoder( const lookup& textTable, const std::span<const std::byte>& data, const std::string_view& terminator ) : m_textTable { textTable }, m_data { data }, m_terminator { terminator } {}
+
+std::vector<text_table::decoder::extent_type> text_table::decoder::measure( missing_type& missing ) const {
+	std::vector<extent_type> extents;
+
+	std::size_t lineOffset = 0;
+	std::size_t length = 0;
+	std::size_t offset = 0;
+	while ( offset < m_data.size() ) {
+		const auto begin = offset;
+		const auto entry = next_code( offset );
+		if ( entry == lookup::npos ) [[unlikely]] {
+			missing.emplace_back( std::cbegin( m_data ) + begin, std::cbegin( m_data ) + offset );
+			continue;
+		}
+
+		const auto value = m_textTable.value( entry );
+		length += value.size();
+		if ( value == m_terminator ) {
+			extents.push_back( { lineOffset, offset - lineOffset, length } );
+			lineOffset = offset;
+			length = 0;
+		}
+	}
+
+	return extents;
+}
+
+void text_table::decoder::decode( const extent_type& extent, char* out ) const noexcept {
+	auto offset = extent.offset;
+	const auto end = extent.offset + extent.size;
+	while ( offset < end ) {
+		if ( const auto entry = next_code( offset ); entry != lookup::npos ) [[likely]] {
+			const auto value = m_textTable.value( entry );
+			out = std::copy( std::cbegin( value ), std::cend( value ), out );
+		}
+	}
+}
+
+std::uint32_t text_table::decoder::next_code( std::size_t& offset ) const noexcept {
+	auto first = std::cbegin( m_data ) + offset;
+	const auto last = std::cend( m_data );
+	const auto entry = m_textTable.find( first, last );
+	if ( first != last ) {
+		++first;
+	}
+
+	offset = static_cast<std::size_t>( std::distance( std::cbegin( m_data ), first ) );
+	return entry;
+}
+
+std::size_t text_table::decoder::decode_line( std::size_t offset, std::string& line ) const {
+	while ( offset < m_data.size() ) {
+		const auto entry = next_code( offset );
+		if ( entry == lookup::npos ) [[unlikely]] {
+			continue;
+		}
+
+		const auto value = m_textTable.value( entry );
+		line.append( value );
+		if ( value == m_terminator ) {
+			return offset;
+		}
+	}
+
+	return npos;
+}
+
+text_table::transcoder::transcoder( const lookup& source, const lookup& destination ) : m_source { source } {
+	m_keys.reserve( source.entries.size() );
+	for ( std::uint32_t ii = 0; ii < source.entries.size(); ++ii ) {
+		m_keys.push_back( destination.rfind( source.value( ii ) ) );
+	}
+}
+
+std::vector<std::byte> text_table::transcoder::translate( const std::span<const std::byte>& data, report_type& report ) const {
+	std::vector<std::byte> translated;
+	translated.reserve( data.size() );
+
+	const auto& codes = m_source.codes;
+	std::vector<std::size_t> missingKeys( codes.entries.size() ); // Per code, as every code is reported on its own
+	std::map<std::vector<std::byte>, std::size_t> missingCodes;
+
+	auto first = std::cbegin( data );
+	const auto last = std::cend( data );
+	while ( first != last ) {
+		const auto begin = first;
+		const auto node = codes.find( first, last );
+		if ( first != last ) {
+			++first;
+		}
+
+		if ( node == lookup::npos ) [[unlikely]] {
+			++missingCodes[std::vector<std::byte>( begin, first )];
+			continue;
+		}
+
+		const auto key = m_keys[codes.entries[node]];
+		if ( key.empty() ) [[unlikely]] {
+			++missingKeys[node];
+			continue;
+		}
+
+		translated.insert( std::end( translated ), std::cbegin( key ), std::cend( key ) );
+	}
+
+	for ( std::uint32_t node = 0; node < missingKeys.size(); ++node ) {
+		if ( missingKeys[node] ) {
+			report.push_back( { m_source.code_of( node ), std::string( m_source.value( codes.entries[node] ) ), missingKeys[node] } );
+		}
+	}
+
+	for ( const auto& [code, count] : missingCodes ) {
+		report.push_back( { code, std::string(), count } );
+	}
+
+	translated.shrink_to_fit();
+	return translated;
+}
@@ -1,9 +1,17 @@
 #ifndef FFV_TEXT_TABLE_HPP
 #define FFV_TEXT_TABLE_HPP
 
+#include <cstdint>
+#include <filesystem>
 #include <istream>
+#include <iterator>
+#include <ostream>
+#include <span>
 #include <string>
+#include <string_view>
+#include <vector>
 
+#include "flat_trie.hpp"
 #include "tree.hpp"
 
 namespace ffv {
@@ -14,6 +22,267 @@ namespace text_table {
 
 	const_type	read( std::istream& streamSource );
 
+	// Reads a .tbl through its compiled copy (path + ".bin"), recompiling whenever the source crc32 no longer matches
+	const_type	load( const std::filesystem::path& path );
+
+	// Compiled tables are the tree's nodes in index order plus a value pool, so loading is a straight copy with no text to parse
+	void		write_compiled( std::ostream& streamDestination, const type& textTable, std::uint32_t sourceHash );
+	const_type	read_compiled( const std::span<const std::byte>& data, std::uint32_t sourceHash ); // Empty if data is not compiled from that source
+
+	// Flat forward (code to value) and reverse (value to code) lookups of a table. Decoding, encoding and transcoding all run
+	// on these, so a table that tbl_to_header wrote out as constexpr data is used as it is, with nothing built at startup
+	struct lookup {
+		using key_type = std::span<const std::byte>;
+
+		static constexpr auto npos = flat_trie<std::byte>::npos;
+
+		struct entry {
+			std::uint32_t	value_offset; // Into value_pool
+			std::uint32_t	value_size;
+			std::uint32_t	key_offset; // Into key_pool
+			std::uint32_t	key_size;
+		};
+
+		flat_trie<std::byte>			codes; // Code bytes to the entry of their value, numbered like the tree's nodes
+		std::span<const std::uint32_t>	code_parents; // Per node of codes, so a code can be spelt back out
+		std::span<const std::byte>		code_keys; // Per node of codes, the last byte of its code
+		flat_trie<char>					values; // Value text to its entry; empty values are left out
+		std::span<const entry>			entries; // One per distinct value, in the order their first code appears
+		std::string_view				value_pool;
+		key_type						key_pool; // The first code of each value, which is the one tree::rfind gives
+
+		bool empty() const noexcept {
+			return entries.empty();
+		}
+
+		constexpr std::string_view value( const std::uint32_t index ) const noexcept {
+			const auto& e = entries[index];
+			return value_pool.substr( e.value_offset, e.value_size );
+		}
+
+		constexpr key_type key( const std::uint32_t index ) const noexcept {
+			const auto& e = entries[index];
+			return key_pool.subspan( e.key_offset, e.key_size );
+		}
+
+		// Entry of the first code on the path of [first, last), npos if there is none; first is left as tree::find leaves it
+		template <class Iter>
+		constexpr std::uint32_t find( Iter& first, const Iter last ) const noexcept {
+			const auto node = codes.find( first, last );
+			return node == npos ? npos : codes.entries[node];
+		}
+
+		// Code of exactly this value, empty if there is none
+		constexpr key_type rfind( const std::string_view& value ) const noexcept {
+			const auto node = values.find_exact( std::cbegin( value ), std::cend( value ) );
+			if ( node == npos || values.entries[node] == npos ) {
+				return key_type();
+			}
+			return key( values.entries[node] );
+		}
+
+		std::vector<std::byte> code_of( std::uint32_t node ) const;
+	};
+
+	// The arrays of a lookup built from a loaded table, or a lookup that keeps its arrays elsewhere (such as embedded data)
+	class lookup_table {
+	public:
+		explicit lookup_table( const type& textTable );
+		explicit lookup_table( const lookup& view ) noexcept : m_view { view } {}
+
+		// Moved vectors keep their storage, so the view stays valid; a copy would still point at the original
+		lookup_table( lookup_table&& other ) noexcept = default;
+		lookup_table( const lookup_table& ) = delete;
+
+		lookup_table& operator =( lookup_table&& other ) noexcept = default;
+		lookup_table& operator =( const lookup_table& ) = delete;
+
+		bool empty() const noexcept {
+			return m_view.empty();
+		}
+
+		const lookup& view() const noexcept {
+			return m_view;
+		}
+
+	protected:
+		template <class Key>
+		struct trie_storage {
+			std::vector<std::uint32_t>	dispatch;
+			std::vector<std::uint32_t>	child_offsets;
+			std::vector<Key>			child_keys;
+			std::vector<std::uint32_t>	child_nodes;
+			std::vector<std::uint32_t>	entries;
+
+			flat_trie<Key> view() const noexcept {
+				return { dispatch, child_offsets, child_keys, child_nodes, entries };
+			}
+		};
+
+		// Nodes are given in index order with the root first, and every parent comes before its children
+		template <class Key>
+		static trie_storage<Key> make_trie( const std::vector<std::uint32_t>& parents, const std::vector<Key>& keys, std::vector<std::uint32_t> entries );
+
+		trie_storage<std::byte>		m_codes;
+		std::vector<std::uint32_t>	m_codeParents;
+		std::vector<std::byte>		m_codeKeys;
+		trie_storage<char>			m_values;
+		std::vector<lookup::entry>	m_entries;
+		std::vector<char>			m_valuePool;
+		std::vector<std::byte>		m_keyPool;
+
+		lookup	m_view;
+
+	};
+
+	// Turns text back into table keys by longest match over the table values
+	class encoder {
+	public:
+		using key_type = lookup::key_type;
+
+		static constexpr auto npos = lookup::npos;
+
+		struct match_type {
+			std::string_view::size_type	length; // Characters consumed (the rest of the string on a miss)
+			key_type					key; // Empty on a miss
+		};
+
+		// Same match, naming the value by its index so callers can keep their own per-value data
+		struct entry_match_type {
+			std::string_view::size_type	length;
+			std::uint32_t				entry; // npos on a miss
+		};
+
+		explicit encoder( const lookup& textTable ) noexcept : m_textTable { textTable } {}
+
+		match_type			match( const std::string_view& str ) const noexcept;
+		entry_match_type	match_entry( const std::string_view& str ) const noexcept;
+
+		std::uint32_t size() const noexcept {
+			return static_cast<std::uint32_t>( m_textTable.entries.size() );
+		}
+
+		key_type key( const std::uint32_t entry ) const noexcept {
+			return m_textTable.key( entry );
+		}
+
+	protected:
+		lookup	m_textTable;
+
+	};
+
+	// Splits coded data into terminated lines of text, either measured up front and written in place, or one line at a time
+	class decoder {
+	public:
+		static constexpr auto npos = static_cast<std::size_t>( -1 );
+
+		struct extent_type {
+			std::size_t	offset; // Into the data
+			std::size_t	size; // Bytes of code, terminator included
+			std::size_t	length; // Characters of text, terminator included
+		};
+
+		using missing_type = std::vector<std::vector<std::byte>>; // Codes the table has no value for, in the order met
+
+		// Decodes the next line on each step; codes with no value are skipped and bytes after the last terminator are dropped
+		class const_iterator {
+		public:
+			using iterator_category = std::input_iterator_tag;
+			using value_type = std::string;
+			using difference_type = std::ptrdiff_t;
+			using pointer = const std::string*;
+			using reference = const std::string&;
+
+			const_iterator() noexcept : m_owner { nullptr }, m_offset { npos }, m_next { npos } {}
+
+			reference operator*() const noexcept {
+				return m_line;
+			}
+
+			pointer operator->() const noexcept {
+				return &m_line;
+			}
+
+			const_iterator& operator++() {
+				m_offset = m_next;
+				read();
+				return *this;
+			}
+
+			void operator++( int ) {
+				++*this;
+			}
+
+			bool operator==( const const_iterator& other ) const noexcept {
+				return m_offset == other.m_offset;
+			}
+
+		protected:
+			friend decoder;
+
+			const_iterator( const decoder& owner, const std::size_t offset ) : m_owner { &owner }, m_offset { offset }, m_next { npos } {
+				read();
+			}
+
+			void read() {
+				m_line.clear();
+				m_next = m_owner->decode_line( m_offset, m_line );
+				if ( m_next == npos ) {
+					m_offset = npos;
+				}
+			}
+
+			const decoder*	m_owner;
+			std::size_t		m_offset;
+			std::size_t		m_next;
+			std::string		m_line;
+
+		};
+
+		decoder( const lookup& textTable, const std::span<const std::byte>& data, const std::string_view& terminator );
+
+		std::vector<extent_type>	measure( missing_type& missing ) const;
+		void						decode( const extent_type& extent, char* out ) const noexcept; // Writes exactly extent.length characters
+
+		const_iterator begin() const {
+			return const_iterator( *this, 0 );
+		}
+
+		const_iterator end() const noexcept {
+			return const_iterator();
+		}
+
+	protected:
+		std::uint32_t	next_code( std::size_t& offset ) const noexcept; // Entry of the code's value, lookup::npos when the table has none
+		std::size_t		decode_line( std::size_t offset, std::string& line ) const; // Offset after the terminator, or npos if there is none
+
+		lookup						m_textTable;
+		std::span<const std::byte>	m_data;
+		std::string					m_terminator;
+
+	};
+
+	// Maps the codes of one table straight to the keys of another table that has the same values
+	class transcoder {
+	public:
+		struct miss_type {
+			std::vector<std::byte>	code;
+			std::string				value; // Empty when the source table has no value for the code
+			std::size_t				count;
+		};
+
+		using report_type = std::vector<miss_type>;
+
+		explicit transcoder( const lookup& source, const lookup& destination );
+
+		std::vector<std::byte>	translate( const std::span<const std::byte>& data, report_type& report ) const;
+
+	protected:
+		lookup							m_source;
+		std::vector<lookup::key_type>	m_keys; // Destination key per source entry, empty when the destination lacks the value
+
+	};
+
 } // text_table
 } // ffv
 
@@ -2,8 +2,11 @@
 #define FFV_TREE_HPP
 
 #include <algorithm>
+#include <array>
+#include <functional>
 #include <optional>
-#include <stack>
+#include <string_view>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -132,9 +135,9 @@ public:
 
 	};
 
-	explicit tree() noexcept : m_nodes( 1, node( this, static_cast<size_type>( 0 ), key_type() ) ) {}
+	explicit tree() noexcept : m_nodes( 1, node( this, static_cast<size_type>( 0 ), static_cast<size_type>( 0 ), key_type() ) ) {}
 
-	tree( const tree& other ) noexcept {
+	tree( const tree& other ) noexcept : m_reverse { other.m_reverse }, m_rootDispatch { other.m_rootDispatch }, m_childOffsets { other.m_childOffsets }, m_childKeys { other.m_childKeys }, m_childNodes { other.m_childNodes } {
 		m_nodes.reserve( other.m_nodes.size() );
 		std::transform( std::cbegin( other.m_nodes ), std::cend( other.m_nodes ), std::back_inserter( m_nodes ),
 			[this]( const node& n ) {
@@ -147,6 +150,45 @@ public:
 		return m_nodes.size() == 1; // only root
 	}
 
+	size_type size() const noexcept {
+		return static_cast<size_type>( m_nodes.size() );
+	}
+
+	void reserve( const size_type count ) noexcept {
+		m_nodes.reserve( count );
+		m_reverse.reserve( count );
+	}
+
+	bool frozen() const noexcept {
+		return !m_childOffsets.empty();
+	}
+
+	// Packs the children of every node into contiguous arrays for lookups; any later insert thaws the tree again
+	void freeze() noexcept {
+		m_childOffsets.clear();
+		m_childKeys.clear();
+		m_childNodes.clear();
+
+		m_childOffsets.reserve( m_nodes.size() + 1 );
+		m_childKeys.reserve( m_nodes.size() - 1 );
+		m_childNodes.reserve( m_nodes.size() - 1 );
+		for ( const auto& n : m_nodes ) {
+			m_childOffsets.push_back( static_cast<size_type>( m_childNodes.size() ) );
+			for ( const auto child : n.m_children ) {
+				m_childKeys.push_back( m_nodes[child].m_key );
+				m_childNodes.push_back( child );
+			}
+		}
+		m_childOffsets.push_back( static_cast<size_type>( m_childNodes.size() ) );
+
+		if constexpr ( root_dispatch ) {
+			m_rootDispatch.fill( npos );
+			for ( const auto child : m_nodes.front().m_children ) {
+				m_rootDispatch[dispatch_index( m_nodes[child].m_key )] = child;
+			}
+		}
+	}
+
 	iterator begin() noexcept {
 		return iterator( *this, 0 );
 	}
@@ -192,71 +234,72 @@ public:
 
 	template <class Iter>
 	const_iterator find( Iter& first, Iter last ) const noexcept {
-		auto it = find( *first );
-
-		if ( it == cend() ) {
-			return cend();
-		}
+		auto pos = child_of( 0, *first );
+		while ( pos != npos ) {
+			if ( m_nodes[pos].m_value.has_value() ) {
+				return const_iterator( *this, pos );
+			}
 
-		do {
-			if ( it->value().has_value() ) {
-				return it;
+			if ( ++first == last ) {
+				break;
 			}
 
-			it.find_next( *++first );
-		} while ( it != cend() && first != last );
+			pos = child_of( pos, *first );
+		}
 
 		return cend();
 	}
 
-	std::vector<key_type> rfind( const value_type& value ) const noexcept {
-		std::stack<size_type> route;
-
-		const auto end = std::find_if( cbegin(), cend(), [&value]( const auto& node ) {
-			return node.value() == value;
-		} );
-
-		if ( end == cend() ) {
-			return std::vector<key_type>();
-		}
-
-		route.push( end->m_index );
-
-		while ( true ) {
-			const auto step = std::find_if( cbegin(), cend(), [&route]( const auto& node ) {
-				return std::find( std::cbegin( node.m_children ), std::cend( node.m_children ), route.top() ) != std::cend( node.m_children );
-			} );
-
-			if ( step->m_index == 0 ) {
-				break; // Got back to root
+	// Longest key that prefixes [first, last); like find, first is left on the final element of the match
+	template <class Iter>
+	const_iterator find_longest( Iter& first, Iter last ) const noexcept {
+		auto match = npos;
+		auto matchLast = first;
+
+		auto pos = size_type { 0 };
+		for ( auto it = first; it != last; ++it ) {
+			pos = child_of( pos, *it );
+			if ( pos == npos ) {
+				break;
 			}
 
-			if ( step == cend() ) {
-				return std::vector<key_type>(); // Failed to reach root
+			if ( m_nodes[pos].m_value.has_value() ) {
+				match = pos;
+				matchLast = it;
 			}
+		}
 
-			route.push( step->m_index );
+		if ( match != npos ) {
+			first = matchLast;
 		}
 
-		std::vector<key_type> key;
-		key.reserve( route.size() );
-		while ( !route.empty() ) {
-			key.push_back( m_nodes[route.top()].m_key );
-			route.pop();
+		return const_iterator( *this, match );
+	}
+
+	std::vector<key_type> key_of( const const_iterator& it ) const noexcept {
+		return path( it.m_pos );
+	}
+
+	template <class Value>
+	std::vector<key_type> rfind( const Value& value ) const noexcept {
+		const auto it = m_reverse.find( value );
+		if ( it == std::cend( m_reverse ) ) {
+			return std::vector<key_type>();
 		}
 
-		return key;
+		return path( it->second );
 	}
 
 	template <class Iter>
 	auto insert( Iter first, Iter last, const value_type& value ) noexcept -> std::enable_if_t<std::is_same_v<typename std::iterator_traits<Iter>::value_type, KeyType>, void> {
 		size_type nodeIndex = 0;
+		thaw();
 		while ( first != last ) {
 			const auto next = m_nodes[nodeIndex].find( *first );
 			if ( next == cend() ) {
 				const auto index = static_cast<size_type>( m_nodes.size() );
 				m_nodes[nodeIndex].m_children.push_back( index );
-				m_nodes.emplace_back( this, index, *first );
+				m_nodes.emplace_back( this, index, nodeIndex, *first );
 				nodeIndex = index;
 			} else {
 				nodeIndex = next.m_pos;
@@ -264,14 +307,34 @@ public:
 			++first;
 		}
 
-		m_nodes[nodeIndex].m_value = value;
+		auto& nodeValue = m_nodes[nodeIndex].m_value;
+		if ( nodeValue.has_value() ) [[unlikely]] {
+			const auto previous = std::move( nodeValue.value() );
+			nodeValue = value;
+			reindex_value( previous );
+		} else {
+			nodeValue = value;
+		}
+		index_value( nodeIndex );
+	}
+
+	// Adds a node under an existing one; appending nodes in their original index order rebuilds an identical tree
+	void append( const size_type parent, const key_type& key, const std::optional<value_type>& value ) noexcept {
+		const auto index = size();
+		thaw();
+		m_nodes[parent].m_children.push_back( index );
+		m_nodes.emplace_back( this, index, parent, key );
+		if ( value.has_value() ) {
+			m_nodes.back().m_value = value;
+			index_value( index );
+		}
 	}
 
 protected:
 	class node {
 		friend tree;
 	public:
-		explicit node( tree * const owner, const size_type index, const key_type& key ) noexcept : m_key { key }, m_value {}, m_owner { owner }, m_index { index }, m_children {} {}
+		explicit node( tree * const owner, const size_type index, const size_type parent, const key_type& key ) noexcept : m_key { key }, m_value {}, m_owner { owner }, m_index { index }, m_parent { parent }, m_children {} {}
 
 		auto& value() noexcept {
 			return m_value;
@@ -281,6 +344,14 @@ protected:
 			return m_value;
 		}
 
+		const auto& key() const noexcept {
+			return m_key;
+		}
+
+		auto parent() const noexcept {
+			return m_parent;
+		}
+
 		std::pair<iterator, bool> insert( const key_type& key ) noexcept {
 			auto iter = find( key );
 			if ( iter != m_owner->end() ) {
@@ -291,32 +362,21 @@ protected:
 			m_children.push_back( index );
 
 			const auto owner = m_owner;
-			owner->m_nodes.emplace_back( owner, index, key );
+			owner->thaw();
+			owner->m_nodes.emplace_back( owner, index, m_index, key );
 			return std::make_pair( iterator( *owner, index ), true );
 		}
 
 		iterator find( const key_type& key ) noexcept {
-			for ( const auto& child : m_children ) {
-				const auto& node = m_owner->m_nodes[child];
-				if ( node.m_key == key ) {
-					return iterator( *m_owner, node.m_index );
-				}
-			}
-			return m_owner->end();
+			return iterator( *m_owner, m_owner->child_of( m_index, key ) );
 		}
 
 		const_iterator find( const key_type& key ) const noexcept {
-			for ( const auto& child : m_children ) {
-				const auto& node = m_owner->m_nodes[child];
-				if ( node.m_key == key ) {
-					return const_iterator( *m_owner, node.m_index );
-				}
-			}
-			return m_owner->cend();
+			return const_iterator( *m_owner, m_owner->child_of( m_index, key ) );
 		}
 
 	protected:
-		explicit node( tree * const owner, const node& other ) noexcept : m_key { other.m_key }, m_value { other.m_value }, m_owner { owner }, m_index { other.m_index }, m_children { other.m_children } {}
+		explicit node( tree * const owner, const node& other ) noexcept : m_key { other.m_key }, m_value { other.m_value }, m_owner { owner }, m_index { other.m_index }, m_parent { other.m_parent }, m_children { other.m_children } {}
 
 		const key_type				m_key;
 		std::optional<value_type>	m_value;
@@ -324,11 +384,104 @@ protected:
 	private:
 		tree * const			m_owner;
 		const size_type			m_index;
+		const size_type			m_parent;
 		std::vector<size_type>	m_children;
 
 	};
 
+	// Hashes strings through std::string_view so rfind can look up views and literals without building a value_type
+	struct value_hash {
+		using is_transparent = void;
+
+		template <class Type>
+		std::size_t operator ()( const Type& value ) const noexcept {
+			if constexpr ( std::is_convertible_v<const Type&, std::string_view> ) {
+				return std::hash<std::string_view> {}( value );
+			} else {
+				return std::hash<value_type> {}( value );
+			}
+		}
+	};
+
+	using reverse_index_type = std::unordered_map<value_type, size_type, value_hash, std::equal_to<>>;
+
+	static constexpr auto npos = static_cast<size_type>( -1 );
+
+	// Byte sized keys get a full 256 entry table for the first step, which is where every lookup starts
+	static constexpr bool root_dispatch = sizeof( key_type ) == 1;
+
+	static constexpr std::size_t dispatch_index( const key_type& key ) noexcept {
+		return static_cast<unsigned char>( key );
+	}
+
+	size_type child_of( const size_type parent, const key_type& key ) const noexcept {
+		if ( !frozen() ) {
+			for ( const auto child : m_nodes[parent].m_children ) {
+				if ( m_nodes[child].m_key == key ) {
+					return child;
+				}
+			}
+			return npos;
+		}
+
+		if constexpr ( root_dispatch ) {
+			if ( parent == 0 ) {
+				return m_rootDispatch[dispatch_index( key )];
+			}
+		}
+
+		const auto keys = std::cbegin( m_childKeys );
+		const auto first = keys + m_childOffsets[parent];
+		const auto last = keys + m_childOffsets[parent + 1];
+		const auto it = std::find( first, last, key );
+		return it == last ? npos : m_childNodes[std::distance( keys, it )];
+	}
+
+	void thaw() noexcept {
+		m_childOffsets.clear();
+	}
+
+	std::vector<key_type> path( size_type index ) const noexcept {
+		size_type depth = 0;
+		for ( auto ii = index; ii != 0; ii = m_nodes[ii].m_parent ) {
+			++depth;
+		}
+
+		std::vector<key_type> key( depth );
+		while ( index != 0 ) {
+			key[--depth] = m_nodes[index].m_key;
+			index = m_nodes[index].m_parent;
+		}
+
+		return key;
+	}
+
+	void index_value( const size_type index ) noexcept {
+		// Lowest node index wins a shared value, same as a front-to-back search
+		const auto [it, inserted] = m_reverse.try_emplace( m_nodes[index].m_value.value(), index );
+		if ( !inserted && index < it->second ) {
+			it->second = index;
+		}
+	}
+
+	void reindex_value( const value_type& value ) noexcept {
+		// Value was overwritten, point it at whichever node still holds it (if any)
+		m_reverse.erase( value );
+		const auto it = std::find_if( std::cbegin( m_nodes ), std::cend( m_nodes ), [&value]( const node& n ) {
+			return n.m_value == value;
+		} );
+		if ( it != std::cend( m_nodes ) ) {
+			m_reverse.emplace( value, it->m_index );
+		}
+	}
+
 	std::vector<node>	m_nodes;
+	reverse_index_type	m_reverse;
+
+	std::array<size_type, 256>	m_rootDispatch {};
+	std::vector<size_type>		m_childOffsets;
+	std::vector<key_type>		m_childKeys;
+	std::vector<size_type>		m_childNodes;
 
 };
 
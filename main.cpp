@@ -1,20 +1,66 @@
-﻿#include <fstream>
+﻿#include <algorithm>
+#include <filesystem>
+#include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <optional>
 #include <sstream>
+#include <thread>
 
 #include "ffv/gba.hpp"
 #include "ffv/gba_texts.hpp"
 #include "ffv/ips_writer.hpp"
+#include "ffv/mapped_file.hpp"
 #include "ffv/rom.hpp"
+#include "ffv/rom_view.hpp"
 #include "ffv/text_mutator.hpp"
 #include "ffv/text_table.hpp"
 
+#if defined( FFV_EMBEDDED_TABLES )
+#include "ffv/embedded/gba.hpp"
+#include "ffv/embedded/gba_battle.hpp"
+#include "ffv/embedded/sfc.hpp"
+#include "ffv/embedded/sfc_battle.hpp"
+#endif
+
+// Positional arguments and options; the text table paths are null when they were left out for the embedded tables
+struct command_line {
+	const char*	ips;
+	const char*	sfc_table;
+	const char*	address;
+	const char*	end;
+	const char*	gba_rom;
+	const char*	gba_table;
+	const char*	text_begin;
+	const char*	sfc_battle_table;
+	const char*	gba_battle_table;
+
+	std::optional<std::size_t>	text_offset; // --text-table=<hex offset>, needed when the ROM has more than one TEXT table
+	std::optional<std::size_t>	font_offset; // --font-table=<hex offset>, likewise for FONT tables
+};
+
+// Tables a missing path falls back to, all null unless the tables are compiled in
+struct embedded_tables {
+	const ffv::text_table::lookup*	sfc;
+	const ffv::text_table::lookup*	gba;
+	const ffv::text_table::lookup*	sfc_battle;
+	const ffv::text_table::lookup*	gba_battle;
+};
+
+#if defined( FFV_EMBEDDED_TABLES )
+static constexpr auto embedded = embedded_tables { &ffv::embedded::sfc, &ffv::embedded::gba, &ffv::embedded::sfc_battle, &ffv::embedded::gba_battle };
+#else
+static constexpr auto embedded = embedded_tables {};
+#endif
+
 struct rpge_constants {
 	static constexpr std::uint32_t crc32 = 0xf11f1026;
 };
 
-static std::vector<std::byte> to_agb( const ffv::rom& ipsRom, std::uint32_t address, std::uint32_t end, const ffv::text_table::type& sfcTextTable, const ffv::text_table::type& gbaTextTable );
+static command_line read_command_line( int argc, char * argv[] );
+static std::size_t select_table( const std::vector<std::size_t>& offsets, const std::optional<std::size_t>& requested, const std::string_view& kind );
+static ffv::text_table::lookup_table load_table( const char* path, const ffv::text_table::lookup* embeddedTable, const std::string_view& name );
+static std::vector<std::byte> to_agb( const ffv::rom& ipsRom, std::uint32_t address, std::uint32_t end, const ffv::text_table::transcoder& sfcToGba );
 
 static constexpr std::pair<std::string_view, std::string_view> find_replace[] = {
 	{ "Ca...", "Kr..." },
@@ -508,23 +554,26 @@ static constexpr std::pair<std::uint32_t, std::string_view> dialog_mark[] = {
 	{ 1042, "`02`: Are you going to" }, { 1042, "And you'll" },
 };
 
-static std::vector<std::string> battle_dialog( const ffv::rom& ipsRom, const ffv::text_table::const_type& gbaTextTable, const ffv::text_table::const_type& sfcTextTable, const ffv::gba::font_table& fontTable );
+static void load_reflow_cache( ffv::text_mutator& mutator, const std::filesystem::path& path );
+static void save_reflow_cache( const ffv::text_mutator& mutator, const std::filesystem::path& path );
+static std::vector<std::string> battle_dialog( const ffv::rom& ipsRom, const ffv::text_table::lookup& gbaTextTable, const ffv::text_table::lookup& sfcTextTable, const ffv::gba::font_view& fontTable, const std::filesystem::path& reflowCachePath );
 
 int main( int argc, char * argv[] ) {
-	const auto ipsRom = ffv::rom::read_ips( std::ifstream( argv[1], std::istream::binary ) );
+	const auto args = read_command_line( argc, argv );
+
+	const auto ipsRom = ffv::rom::read_ips( std::ifstream( args.ips, std::istream::binary ) );
 	if ( ipsRom.hash() != rpge_constants::crc32 ) [[unlikely]] {
 		throw std::invalid_argument( "Stream is not RPGe v1.1" );
 	}
 
-	const auto sfcTextTable = ffv::text_table::read( std::ifstream( argv[2] ) );
-	if ( sfcTextTable.empty() ) [[unlikely]] {
-		throw std::invalid_argument( "Invalid or corrupt SFC text table" );
-	}
+	const auto sfcTextTable = load_table( args.sfc_table, embedded.sfc, "SFC" );
 
-	auto gbaStream = std::ifstream( argv[5], std::istream::binary );
-	const auto gbaStart = gbaStream.tellg();
+	const auto gbaRom = ffv::rom_view( args.gba_rom );
+	if ( gbaRom.empty() ) [[unlikely]] {
+		throw std::invalid_argument( "Missing or empty GBA ROM" );
+	}
 
-	const auto gbaHeader = ffv::gba::read_header( gbaStream );
+	const auto gbaHeader = ffv::gba::read_header( gbaRom.data() );
 	if ( !gbaHeader.logo_code ) {
 		std::cout << "Warning: GBA header missing logo\n";
 	}
@@ -535,48 +584,37 @@ int main( int argc, char * argv[] ) {
 		std::cout << "Warning: GBA header complement check fail\n";
 	}
 
-	gbaStream.seekg( gbaStart );
-	ffv::gba::find_texts( gbaStream );
-	if ( !gbaStream.good() ) [[unlikely]] {
-		throw std::invalid_argument( "Missing text table" );
-	}
+	const auto gbaTables = ffv::gba::find_tables( gbaRom.data() );
 
-	const auto textStart = gbaStream.tellg();
-	const auto textData = ffv::gba::read_texts( gbaStream );
-	const auto textBegin = std::stoul( argv[7], nullptr, 10 );
+	const auto textStart = select_table( gbaTables.texts, args.text_offset, "text" );
+	const auto textData = ffv::gba::text_view( gbaRom.data().subspan( textStart ) );
+	const auto textBegin = std::stoul( args.text_begin, nullptr, 10 );
 
-	gbaStream.seekg( gbaStart );
-	ffv::gba::find_fonts( gbaStream );
-	if ( !gbaStream.good() ) [[unlikely]] {
-		throw std::invalid_argument( "Missing font table" );
-	}
+	const auto fontStart = select_table( gbaTables.fonts, args.font_offset, "font" );
+	const auto fontTable = ffv::gba::view_fonts( gbaRom.data().subspan( fontStart ) );
 
-	const auto fontTable = ffv::gba::read_fonts( gbaStream );
-
-	const auto gbaTextTable = ffv::text_table::read( std::ifstream( argv[6] ) );
-	if ( gbaTextTable.empty() ) [[unlikely]] {
-		throw std::invalid_argument( "Invalid or corrupt GBA text table" );
-	}
+	const auto gbaTextTable = load_table( args.gba_table, embedded.gba, "GBA" );
 
 	const auto itemLength = ffv::gba::max_text_length( textData, {
 		{ 3313, 3431 },
 		{ 3440, 3529 },
 		{ 3535, 3570 },
-	}, gbaTextTable, fontTable );
+	}, gbaTextTable.view(), fontTable );
 
 	const auto abilityLength = ffv::gba::max_text_length( textData, {
 		{ 4579, 4853 },
-	}, gbaTextTable, fontTable );
+	}, gbaTextTable.view(), fontTable );
 
-	auto address = std::stoul( argv[3], nullptr, 16 );
-	const auto end = std::stoul( argv[4], nullptr, 16 );
+	auto address = std::stoul( args.address, nullptr, 16 );
+	const auto end = std::stoul( args.end, nullptr, 16 );
 	if ( end < address ) [[unlikely]] {
 		throw std::invalid_argument( "Specified text start address greater than text end address" );
 	}
 
 	std::cout << "Translating to GBA\n";
-	const auto agbData = to_agb( ipsRom, address, end, sfcTextTable, gbaTextTable );
-	auto mutator = ffv::text_mutator( agbData, gbaTextTable, fontTable, itemLength, abilityLength );
+	const auto agbData = to_agb( ipsRom, address, end, ffv::text_table::transcoder( sfcTextTable.view(), gbaTextTable.view() ) );
+	auto mutator = ffv::text_mutator( agbData, gbaTextTable.view(), fontTable, itemLength, abilityLength );
+	mutator.set_thread_count( std::thread::hardware_concurrency() );
 
 	std::cout << "Marking manual dialogs\n";
 	for ( const auto& p : dialog_mark ) {
@@ -587,8 +625,8 @@ int main( int argc, char * argv[] ) {
 	std::cout << "Find replace\n";
 	for ( const auto& pair : find_replace ) {
 		std::cout << '\t' << pair.first << " -> " << pair.second << '\n';
-		mutator.find_replace( pair.first, pair.second );
 	}
+	mutator.find_replace( find_replace );
 
 	std::cout << "Indexed find replace\n";
 	for ( const auto& tuple : targetted_find_replace ) {
@@ -606,12 +644,19 @@ int main( int argc, char * argv[] ) {
 		mutator.name_case( name );
 	}
 
+	// Lines that come to the reflows as they did on the last run are replayed from what was made of them then
+	auto reflowCachePath = std::filesystem::path( args.gba_rom );
+	reflowCachePath += ".reflow";
+	load_reflow_cache( mutator, reflowCachePath );
+
 	std::cout << "Reflowing dialog\n";
 	mutator.dialog_reflow();
 
 	std::cout << "Reflowing the not dialog\n";
 	mutator.text_reflow();
 
+	save_reflow_cache( mutator, reflowCachePath );
+
 	std::cout << "Post indexed find replace\n";
 	for ( const auto& tuple : targetted_post_find_replace ) {
 		std::cout << "\t[" << std::get<0>( tuple ) << "] " << std::get<1>( tuple ) << " -> " << std::get<2>( tuple );
@@ -622,96 +667,76 @@ int main( int argc, char * argv[] ) {
 		}
 	}
 
-	const auto sfcBattleTextTable = ffv::text_table::read( std::ifstream( argv[8] ) );
-	if ( sfcBattleTextTable.empty() ) [[unlikely]] {
-		throw std::invalid_argument( "Invalid or corrupt SFC text table" );
-	}
-
-	const auto gbaBattleTextTable = ffv::text_table::read( std::ifstream( argv[9] ) );
-	if ( gbaBattleTextTable.empty() ) [[unlikely]] {
-		throw std::invalid_argument( "Invalid or corrupt GBA text table" );
-	}
+	const auto sfcBattleTextTable = load_table( args.sfc_battle_table, embedded.sfc_battle, "SFC" );
+	const auto gbaBattleTextTable = load_table( args.gba_battle_table, embedded.gba_battle, "GBA" );
 
-	const auto battleLines = battle_dialog( ipsRom, gbaBattleTextTable, sfcBattleTextTable, fontTable );
+	auto battleReflowCachePath = std::filesystem::path( args.gba_rom );
+	battleReflowCachePath += ".battle.reflow";
+	const auto battleLines = battle_dialog( ipsRom, gbaBattleTextTable.view(), sfcBattleTextTable.view(), fontTable, battleReflowCachePath );
 
 	std::cout << "Writing IPS\n";
 
+	const auto gbaEncoder = ffv::text_table::encoder( gbaTextTable.view() );
+	const auto gbaBattleEncoder = ffv::text_table::encoder( gbaBattleTextTable.view() );
+
 	auto writer = ffv::ips::writer();
 
-	writer.seekg( textData.offsets[textBegin] + textStart );
+	writer.seekg( textData.offset( textBegin ) + textStart );
 
 	int offsetIndex = 0;
-	std::uint32_t offset = textData.offsets[textBegin];
+	std::uint32_t offset = textData.offset( textBegin );
 	std::vector<std::uint32_t> offsets;
 	for ( const auto& line : mutator.lines() ) {
 		if ( offsetIndex == 2009 ) {
-			offsets.push_back( textData.offsets[2096] );
-			offsets.push_back( textData.offsets[2097] );
-			offsets.push_back( textData.offsets[2098] );
+			offsets.push_back( textData.offset( 2096 ) );
+			offsets.push_back( textData.offset( 2097 ) );
+			offsets.push_back( textData.offset( 2098 ) );
 		}
 		offsetIndex++;
 
 		offsets.push_back( offset );
 
-		auto begin = std::cbegin( line );
-		while ( begin != std::cend( line ) ) {
-			auto end = begin + 1;
-			auto key = gbaTextTable.rfind( std::string( begin, end ) );
-			while ( key.empty() ) {
-				if ( end == std::cend( line ) ) {
-					break;
-				}
-				++end;
-				key = gbaTextTable.rfind( std::string( begin, end ) );
-			}
-
+		auto str = std::string_view( line );
+		while ( !str.empty() ) {
+			const auto [length, key] = gbaEncoder.match( str );
 			if ( key.empty() ) [[unlikely]] {
-				std::cout << " WARNING No key for string \"" << std::string( begin, end ) << "\"\n";
+				std::cout << " WARNING No key for string \"" << str.substr( 0, length ) << "\"\n";
 			}
 
 			offset += static_cast<std::uint32_t>( key.size() );
 			writer.write( std::cbegin( key ), std::cend( key ) );
 
-			begin = end;
+			str.remove_prefix( length );
 		}
 	}
 
-	writer.seekg( sizeof( textData.header ) + ( 4 * static_cast<std::size_t>( textBegin ) ) + textStart );
+	writer.seekg( sizeof( textData.header() ) + ( 4 * static_cast<std::size_t>( textBegin ) ) + textStart );
 	for ( const auto offset : offsets ) {
 		writer.write( offset );
 	}
 
-	writer.seekg( textData.offsets[2693] + textStart );
+	writer.seekg( textData.offset( 2693 ) + textStart );
 
-	offset = textData.offsets[2693];
+	offset = textData.offset( 2693 );
 	std::vector<std::uint32_t> battleOffsets;
 	for ( const auto& line : battleLines ) {
 		battleOffsets.push_back( offset );
 
-		auto begin = std::cbegin( line );
-		while ( begin != std::cend( line ) ) {
-			auto end = begin + 1;
-			auto key = gbaBattleTextTable.rfind( std::string( begin, end ) );
-			while ( key.empty() ) {
-				if ( end == std::cend( line ) ) {
-					break;
-				}
-				++end;
-				key = gbaBattleTextTable.rfind( std::string( begin, end ) );
-			}
-
+		auto str = std::string_view( line );
+		while ( !str.empty() ) {
+			const auto [length, key] = gbaBattleEncoder.match( str );
 			if ( key.empty() ) [[unlikely]] {
-				std::cout << " WARNING No key for string \"" << std::string( begin, end ) << "\"\n";
+				std::cout << " WARNING No key for string \"" << str.substr( 0, length ) << "\"\n";
 			}
 
 			offset += static_cast<std::uint32_t>( key.size() );
 			writer.write( std::cbegin( key ), std::cend( key ) );
 
-			begin = end;
+			str.remove_prefix( length );
 		}
 	}
 
-	writer.seekg( sizeof( textData.header ) + ( 4 * 2693 ) + textStart );
+	writer.seekg( sizeof( textData.header() ) + ( 4 * 2693 ) + textStart );
 	for ( const auto offset : battleOffsets ) {
 		writer.write( offset );
 	}
@@ -723,37 +748,99 @@ int main( int argc, char * argv[] ) {
 	return 0;
 }
 
-std::vector<std::byte> to_agb( const ffv::rom& ipsRom, std::uint32_t address, std::uint32_t end, const ffv::text_table::type& sfcTextTable, const ffv::text_table::type& gbaTextTable ) {
-	std::vector<std::byte> data;
-
-	auto first = std::cbegin( ipsRom.data() ) + address;
-	const auto last = std::cbegin( ipsRom.data() ) + end;
-	while ( first != last ) {
-		auto begin = first;
-		const auto it = sfcTextTable.find( first, last );
-		++first;
-
-		if ( it != sfcTextTable.cend() && it->value().has_value() ) {
-			const auto gbaKey = gbaTextTable.rfind( it->value().value() );
-			if ( !gbaKey.empty() ) {
-				data.insert( std::end( data ), std::cbegin( gbaKey ), std::cend( gbaKey ) );
-			} else [[unlikely]] {
-				std::cout << "Warning: Missing GBA character for code " << it->value().value() << " : ";
-				while ( begin != first ) {
-					std::cout << std::hex << std::setfill( '0' ) << std::setw( 2 ) << static_cast<int>( *begin++ );
-				}
-				std::cout << '\n';
+command_line read_command_line( int argc, char * argv[] ) {
+	static constexpr auto text_option = std::string_view { "--text-table=" };
+	static constexpr auto font_option = std::string_view { "--font-table=" };
+
+	std::optional<std::size_t> textOffset;
+	std::optional<std::size_t> fontOffset;
+
+	// Options can go anywhere, the rest are positional
+	std::vector<const char*> positional;
+	for ( int ii = 1; ii < argc; ++ii ) {
+		const auto arg = std::string_view( argv[ii] );
+		if ( arg.starts_with( text_option ) ) {
+			textOffset = std::stoul( std::string( arg.substr( text_option.size() ) ), nullptr, 16 );
+		} else if ( arg.starts_with( font_option ) ) {
+			fontOffset = std::stoul( std::string( arg.substr( font_option.size() ) ), nullptr, 16 );
+		} else {
+			positional.push_back( argv[ii] );
+		}
+	}
+
+	const auto& p = positional;
+	if ( p.size() == 9 ) [[likely]] {
+		return { p[0], p[1], p[2], p[3], p[4], p[5], p[6], p[7], p[8], textOffset, fontOffset };
+	}
+
+#if defined( FFV_EMBEDDED_TABLES )
+	// The four table paths can all be left out, leaving <ips> <address> <end> <gba rom> <text begin>
+	if ( p.size() == 5 ) {
+		return { p[0], nullptr, p[1], p[2], p[3], nullptr, p[4], nullptr, nullptr, textOffset, fontOffset };
+	}
+#endif
+
+	throw std::invalid_argument( "Expected <ips> <sfc tbl> <address> <end> <gba rom> <gba tbl> <text begin> <sfc battle tbl> <gba battle tbl> [--text-table=<hex offset>] [--font-table=<hex offset>]" );
+}
+
+std::size_t select_table( const std::vector<std::size_t>& offsets, const std::optional<std::size_t>& requested, const std::string_view& kind ) {
+	if ( offsets.empty() ) [[unlikely]] {
+		throw std::invalid_argument( "Missing " + std::string( kind ) + " table" );
+	}
+
+	if ( requested ) {
+		if ( std::find( std::cbegin( offsets ), std::cend( offsets ), *requested ) == std::cend( offsets ) ) [[unlikely]] {
+			std::ostringstream message;
+			message << "No " << kind << " table at 0x" << std::hex << *requested;
+			throw std::invalid_argument( message.str() );
+		}
+		return *requested;
+	}
+
+	// Picking one would silently patch whichever table happens to come first, so the user has to say which
+	if ( offsets.size() > 1 ) [[unlikely]] {
+		std::ostringstream message;
+		message << "Found " << offsets.size() << ' ' << kind << " tables at";
+		for ( const auto offset : offsets ) {
+			message << " 0x" << std::hex << offset;
+		}
+		message << ", choose one with --" << kind << "-table=<hex offset>";
+		throw std::invalid_argument( message.str() );
+	}
+
+	return offsets.front();
+}
+
+ffv::text_table::lookup_table load_table( const char* path, const ffv::text_table::lookup* embeddedTable, const std::string_view& name ) {
+	auto textTable = path ? ffv::text_table::lookup_table( ffv::text_table::load( path ) ) : ffv::text_table::lookup_table( *embeddedTable );
+	if ( textTable.empty() ) [[unlikely]] {
+		throw std::invalid_argument( "Invalid or corrupt " + std::string( name ) + " text table" );
+	}
+
+	return textTable;
+}
+
+std::vector<std::byte> to_agb( const ffv::rom& ipsRom, std::uint32_t address, std::uint32_t end, const ffv::text_table::transcoder& sfcToGba ) {
+	auto report = ffv::text_table::transcoder::report_type();
+	const auto data = sfcToGba.translate( std::span( ipsRom.data() ).subspan( address, end - address ), report );
+
+	if ( !report.empty() ) [[unlikely]] {
+		std::ostringstream warnings;
+		for ( const auto& miss : report ) {
+			if ( miss.value.empty() ) {
+				warnings << "Warning: Missing SFC character for code ";
+			} else {
+				warnings << "Warning: Missing GBA character for code " << miss.value << " : ";
 			}
-		} else [[unlikely]] {
-			std::cout << "Warning: Missing SFC character for code ";
-			while ( begin != first ) {
-				std::cout << std::hex << std::setfill( '0' ) << std::setw( 2 ) << static_cast<int>( *begin++ );
+
+			for ( const auto byte : miss.code ) {
+				warnings << std::hex << std::setfill( '0' ) << std::setw( 2 ) << static_cast<int>( byte );
 			}
-			std::cout << '\n';
+			warnings << std::dec << " (x" << miss.count << ")\n";
 		}
+		std::cout << warnings.str();
 	}
 
-	data.shrink_to_fit();
 	return data;
 }
 
@@ -761,23 +848,47 @@ static constexpr std::tuple<std::uint32_t, std::string_view, std::string_view> b
 	{}
 };
 
-std::vector<std::string> battle_dialog( const ffv::rom& ipsRom, const ffv::text_table::const_type& gbaTextTable, const ffv::text_table::const_type& sfcTextTable, const ffv::gba::font_table& fontTable ) {
-	const auto agbBattle = to_agb( ipsRom, 0x273B00 + 0x200, 0x2750FF, sfcTextTable, gbaTextTable );
+void load_reflow_cache( ffv::text_mutator& mutator, const std::filesystem::path& path ) {
+	if ( const auto cache = ffv::mapped_file( path ); !cache.empty() ) {
+		if ( !mutator.read_reflow_cache( cache.data() ) ) {
+			std::cout << "Reflow cache " << path.string() << " is out of date, reflowing every line\n";
+		}
+	}
+}
+
+void save_reflow_cache( const ffv::text_mutator& mutator, const std::filesystem::path& path ) {
+	auto streamDestination = std::ofstream( path, std::ostream::binary | std::ostream::trunc );
+	mutator.write_reflow_cache( streamDestination );
+	streamDestination.close();
+	if ( !streamDestination ) [[unlikely]] {
+		// Only costs time, the next run reflows every line
+		std::cout << "Warning: Could not write reflow cache " << path.string() << '\n';
+	}
+}
+
+std::vector<std::string> battle_dialog( const ffv::rom& ipsRom, const ffv::text_table::lookup& gbaTextTable, const ffv::text_table::lookup& sfcTextTable, const ffv::gba::font_view& fontTable, const std::filesystem::path& reflowCachePath ) {
+	const auto agbBattle = to_agb( ipsRom, 0x273B00 + 0x200, 0x2750FF, ffv::text_table::transcoder( sfcTextTable, gbaTextTable ) );
 	auto mutator = ffv::text_mutator( agbBattle, gbaTextTable, fontTable, 0, 0 );
+	mutator.set_thread_count( std::thread::hardware_concurrency() );
 
 	std::cout << "Battle Find replace\n";
 	for ( const auto& pair : find_replace ) {
 		std::cout << '\t' << pair.first << " -> " << pair.second << '\n';
-		mutator.find_replace( pair.first, pair.second );
 	}
+	mutator.find_replace( find_replace );
 
 	std::cout << "Battle Bartz\n";
 	mutator.battle_bartz();
 
+	load_reflow_cache( mutator, reflowCachePath );
+
 	std::cout << "Battle dialog reflow\n";
 	mutator.dialog_reflow();
 
-	return mutator.lines();
+	save_reflow_cache( mutator, reflowCachePath );
+
+	const auto& lines = mutator.lines();
+	return { std::cbegin( lines ), std::cend( lines ) };
 
 	/*
 	std::cout << "Battle indexed find replace\n";
@@ -0,0 +1,133 @@
+// Build step for FFVTOOL_EMBED_TABLES: writes a .tbl out as the constexpr arrays of a ffv::text_table::lookup
+// usage: tbl_to_header <table.tbl> <header.hpp> <name>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <fstream>
+#include <span>
+#include <iostream>
+#include <string>
+#include <string_view>
+
+#include "../ffv/text_table.hpp"
+
+static std::string to_literal( const std::string_view& bytes ) {
+	std::string literal = "std::string_view( \"";
+	for ( const auto c : bytes ) {
+		const auto u = static_cast<unsigned char>( c );
+		if ( u >= 0x20 && u < 0x7f && c != '"' && c != '\\' && c != '?' ) [[likely]] {
+			literal.push_back( c );
+		} else {
+			// Always three octal digits, so a following digit can't join the escape
+			char escape[5];
+			std::snprintf( escape, sizeof( escape ), "\\%03o", u );
+			literal.append( escape );
+		}
+	}
+	return literal + "\", " + std::to_string( bytes.size() ) + " )";
+}
+
+static void write_byte( std::ostream& streamDestination, const std::byte value ) {
+	char hex[5];
+	std::snprintf( hex, sizeof( hex ), "0x%02x", std::to_integer<unsigned>( value ) );
+	streamDestination << "std::byte { " << hex << " }";
+}
+
+static void write_byte( std::ostream& streamDestination, const char value ) {
+	char octal[7];
+	std::snprintf( octal, sizeof( octal ), "'\\%03o'", static_cast<unsigned char>( value ) );
+	streamDestination << octal;
+}
+
+static void write_byte( std::ostream& streamDestination, const std::uint32_t value ) {
+	if ( value == ffv::text_table::lookup::npos ) {
+		streamDestination << "0xffffffff";
+	} else {
+		streamDestination << value;
+	}
+}
+
+static void write_byte( std::ostream& streamDestination, const ffv::text_table::lookup::entry& value ) {
+	streamDestination << "{ " << value.value_offset << ", " << value.value_size << ", " << value.key_offset << ", " << value.key_size << " }";
+}
+
+// std::array rather than a C array, as some of these can be empty
+template <class Type>
+static void write_array( std::ostream& streamDestination, const std::string_view& type, const std::string_view& name, const std::span<const Type>& values ) {
+	streamDestination << "\tinline constexpr std::array<" << type << ", " << values.size() << "> " << name << " = { {";
+	for ( std::size_t ii = 0; ii < values.size(); ++ii ) {
+		streamDestination << ( ii % 8 ? " " : "\n\t\t" );
+		write_byte( streamDestination, values[ii] );
+		streamDestination << ',';
+	}
+	streamDestination << ( values.empty() ? "} };\n\n" : "\n\t} };\n\n" );
+}
+
+template <class Key>
+static void write_trie( std::ostream& streamDestination, const std::string_view& keyType, const std::string& name, const ffv::flat_trie<Key>& trie ) {
+	write_array( streamDestination, "std::uint32_t", name + "_dispatch", trie.dispatch );
+	write_array( streamDestination, "std::uint32_t", name + "_child_offsets", trie.child_offsets );
+	write_array( streamDestination, keyType, name + "_child_keys", trie.child_keys );
+	write_array( streamDestination, "std::uint32_t", name + "_child_nodes", trie.child_nodes );
+	write_array( streamDestination, "std::uint32_t", name + "_entries", trie.entries );
+}
+
+static std::string trie_initializer( const std::string& data, const std::string& name ) {
+	const auto prefix = data + "::" + name;
+	return "{ " + prefix + "_dispatch, " + prefix + "_child_offsets, " + prefix + "_child_keys, " + prefix + "_child_nodes, " + prefix + "_entries }";
+}
+
+int main( int argc, char * argv[] ) {
+	if ( argc != 4 ) {
+		std::cerr << "usage: tbl_to_header <table.tbl> <header.hpp> <name>\n";
+		return 1;
+	}
+
+	const std::string name = argv[3];
+	const std::string data = name + "_data";
+
+	auto streamSource = std::ifstream( argv[1] );
+	const auto textTable = ffv::text_table::read( streamSource );
+	if ( textTable.empty() ) {
+		std::cerr << "Invalid or corrupt text table " << argv[1] << '\n';
+		return 1;
+	}
+
+	// The same arrays a loaded table is decoded and encoded through, written out so nothing is built at startup
+	const auto table = ffv::text_table::lookup_table( textTable );
+	const auto& lookup = table.view();
+
+	std::string guard = "FFV_EMBEDDED_";
+	std::transform( std::cbegin( name ), std::cend( name ), std::back_inserter( guard ), []( const char c ) {
+		return static_cast<char>( std::toupper( static_cast<unsigned char>( c ) ) );
+	} );
+	guard += "_HPP";
+
+	auto streamDestination = std::ofstream( argv[2], std::ostream::trunc );
+	streamDestination << "// Generated by tbl_to_header from " << argv[1] << ", edit the table rather than this file\n"
+		<< "#ifndef " << guard << "\n#define " << guard << "\n\n"
+		<< "#include <array>\n#include <cstdint>\n#include <string_view>\n\n"
+		<< "#include \"ffv/text_table.hpp\"\n\n"
+		<< "namespace ffv {\nnamespace embedded {\nnamespace " << data << " {\n\n";
+
+	write_trie( streamDestination, "std::byte", "codes", lookup.codes );
+	write_array( streamDestination, "std::uint32_t", "code_parents", lookup.code_parents );
+	write_array( streamDestination, "std::byte", "code_keys", lookup.code_keys );
+	write_trie( streamDestination, "char", "values", lookup.values );
+	write_array( streamDestination, "text_table::lookup::entry", "entries", lookup.entries );
+	streamDestination << "\tinline constexpr auto value_pool = " << to_literal( lookup.value_pool ) << ";\n\n";
+	write_array( streamDestination, "std::byte", "key_pool", lookup.key_pool );
+
+	streamDestination << "} // " << data << "\n\n"
+		<< "inline constexpr text_table::lookup " << name << " {\n"
+		<< "\t" << trie_initializer( data, "codes" ) << ",\n"
+		<< "\t" << data << "::code_parents, " << data << "::code_keys,\n"
+		<< "\t" << trie_initializer( data, "values" ) << ",\n"
+		<< "\t" << data << "::entries, " << data << "::value_pool, " << data << "::key_pool\n"
+		<< "};\n\n"
+		<< "} // embedded\n} // ffv\n\n"
+		<< "#endif // define " << guard << '\n';
+
+	return streamDestination.good() ? 0 : 1;
+}